@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+/* The cache file is a sequence of NUL-terminated strings: a header of
+CACHE_MAGIC, CACHE_VERSION, the sysroot and the mtimes of fstab and the rules
+file, followed by N_RECORD_FIELDS strings for each node.  The device fields are
+empty for nodes that are not mountable, as are profile keys and by-id links
+udev did not report.  A cache made for a different root, or before fstab or
+the rules last changed, is ignored, since fstab decides which devices are
+mountable and the rules what to do with them. */
+#define CACHE_MAGIC "pmount-gui-ng-cache"
+#define CACHE_VERSION "4"
+#define N_RECORD_FIELDS 15
+
+/**
+Writes the name of the device cache file to buf.  The file is in
+$XDG_CACHE_HOME, or ~/.cache if that is not set.  Returns 0 on success or -1 if
+there is no suitable directory.
+*/
+int get_cache_filename(char *buf, int size)
+{
+    char *dir;
+
+    dir = getenv("XDG_CACHE_HOME");
+    if(dir && dir[0]=='/')
+        snprintf(buf, size, "%s/pmount-gui-ng/devices", dir);
+    else
+    {
+        dir = getenv("HOME");
+        if(!dir || !dir[0])
+            return -1;
+        snprintf(buf, size, "%s/.cache/pmount-gui-ng/devices", dir);
+    }
+
+    return 0;
+}
+
+/**
+Writes the mtimes of fstab and of the loaded rules to buf as a string, with 0
+for a missing file.
+*/
+static void get_config_stamp(char *buf, int size)
+{
+    char fnbuf[1100];
+    struct stat st;
+
+    snprintf(fnbuf, sizeof(fnbuf), "%s/etc/fstab", sysroot);
+    if(stat(fnbuf, &st)<0)
+        st.st_mtime = 0;
+    snprintf(buf, size, "%lld:%lld", (long long)st.st_mtime, (long long)(automount_rules ? automount_rules->time : 0));
+}
+
+/**
+Returns the string at *pos and advances past it, or NULL if the buffer ends
+before the string does.
+*/
+static char *next_field(char **pos, char *end)
+{
+    char *field = *pos;
+    int len;
+
+    if(field>=end)
+        return NULL;
+    len = strlen(field);
+    if(field+len>=end)
+        return NULL;
+    *pos = field+len+1;
+
+    return field;
+}
+
+/**
+Reads the device cache.  Returns an array of count nodes, or NULL if there is
+no valid cache.  Devices in the array have no mount state; it is not cached
+since it changes too often.
+*/
+CachedNode *load_device_cache(char *filename, int *count)
+{
+    char *buf;
+    char *pos;
+    char *end;
+    char *header[4];
+    char stamp[64];
+    CachedNode *nodes = NULL;
+    int n_nodes = 0;
+    int size;
+    int i;
+
+    *count = 0;
+    buf = read_small_file(filename, &size);
+    if(!buf)
+        return NULL;
+    pos = buf;
+    end = buf+size;
+
+    get_config_stamp(stamp, sizeof(stamp));
+    for(i=0; i<4; ++i)
+        header[i] = next_field(&pos, end);
+    if(!header[3] || strcmp(header[0], CACHE_MAGIC) || strcmp(header[1], CACHE_VERSION)
+        || strcmp(header[2], sysroot) || strcmp(header[3], stamp))
+    {
+        if(verbosity>=1)
+            printf("Device cache %s is out of date\n", filename);
+        free(buf);
+        return NULL;
+    }
+
+    while(pos<end)
+    {
+        char *fields[N_RECORD_FIELDS];
+        CachedNode *cn;
+
+        for(i=0; i<N_RECORD_FIELDS; ++i)
+            if(!(fields[i] = next_field(&pos, end)))
+                break;
+        if(i<N_RECORD_FIELDS)
+            break;
+
+        nodes = (CachedNode *)realloc(nodes, (n_nodes+1)*sizeof(CachedNode));
+        cn = &nodes[n_nodes++];
+        cn->node = strdup(fields[0]);
+        cn->target = strdup(fields[1]);
+        cn->time = (time_t)atoll(fields[2]);
+        cn->dev = NULL;
+
+        if(!strcmp(fields[3], "1"))
+        {
+            Device *dev = (Device *)calloc(1, sizeof(Device));
+            dev->node = strdup(fields[0]);
+            dev->devname = strdup(fields[4]);
+            dev->label = strdup(fields[5]);
+            dev->description = strdup(fields[6]);
+            dev->shortdev = strdup(fields[7]);
+            dev->devnum = (dev_t)strtoull(fields[8], NULL, 10);
+            dev->rule = atoi(fields[9]);
+            dev->action = atoi(fields[10]);
+            dev->uuid = (fields[11][0] ? strdup(fields[11]) : NULL);
+            dev->serial = (fields[12][0] ? strdup(fields[12]) : NULL);
+            dev->fs_type = (fields[13][0] ? strdup(fields[13]) : NULL);
+            dev->link = (fields[14][0] ? strdup(fields[14]) : NULL);
+            if(dev->action<0 || dev->action>=N_RULE_ACTIONS)
+                dev->action = ACTION_NONE;
+            dev->time = cn->time;
+            cn->dev = dev;
+        }
+    }
+
+    free(buf);
+    if(verbosity>=1)
+        printf("Read %d nodes from %s\n", n_nodes, filename);
+
+    *count = n_nodes;
+    return nodes;
+}
+
+/**
+Writes a string including its terminating NUL.
+*/
+static void write_field(FILE *file, char *str)
+{
+    fwrite((str ? str : ""), 1, (str ? strlen(str) : 0)+1, file);
+}
+
+/**
+Writes the device cache.  The file is replaced atomically, so a reader never
+sees a partial cache.  Returns 0 on success or -1 on failure.
+*/
+int save_device_cache(char *filename, CachedNode *nodes, int count)
+{
+    char tmpname[1100];
+    char stamp[64];
+    FILE *file;
+    int i;
+
+    make_file_dir(filename);
+    snprintf(tmpname, sizeof(tmpname), "%s.%d", filename, (int)getpid());
+    file = fopen(tmpname, "w");
+    if(!file)
+        return -1;
+
+    get_config_stamp(stamp, sizeof(stamp));
+    write_field(file, CACHE_MAGIC);
+    write_field(file, CACHE_VERSION);
+    write_field(file, sysroot);
+    write_field(file, stamp);
+
+    for(i=0; i<count; ++i)
+    {
+        Device *dev = nodes[i].dev;
+        char buf[32];
+
+        write_field(file, nodes[i].node);
+        write_field(file, nodes[i].target);
+        snprintf(buf, sizeof(buf), "%lld", (long long)nodes[i].time);
+        write_field(file, buf);
+        write_field(file, (dev ? "1" : "0"));
+        write_field(file, (dev ? dev->devname : NULL));
+        write_field(file, (dev ? dev->label : NULL));
+        write_field(file, (dev ? dev->description : NULL));
+        write_field(file, (dev ? dev->shortdev : NULL));
+        snprintf(buf, sizeof(buf), "%llu", (dev ? (unsigned long long)dev->devnum : 0ULL));
+        write_field(file, buf);
+        snprintf(buf, sizeof(buf), "%d", (dev ? dev->rule : 0));
+        write_field(file, buf);
+        snprintf(buf, sizeof(buf), "%d", (dev ? (int)dev->action : 0));
+        write_field(file, buf);
+        write_field(file, (dev ? dev->uuid : NULL));
+        write_field(file, (dev ? dev->serial : NULL));
+        write_field(file, (dev ? dev->fs_type : NULL));
+        write_field(file, (dev ? dev->link : NULL));
+    }
+
+    if(fclose(file)!=0 || rename(tmpname, filename)<0)
+    {
+        unlink(tmpname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+Frees an array of cached nodes, including their devices.
+*/
+void free_cached_nodes(CachedNode *nodes, int count)
+{
+    int i;
+
+    for(i=0; i<count; ++i)
+    {
+        free(nodes[i].node);
+        free(nodes[i].target);
+        if(nodes[i].dev)
+            free_device(nodes[i].dev);
+    }
+    free(nodes);
+}
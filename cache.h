@@ -0,0 +1,23 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <time.h>
+#include "devices.h"
+
+/* A /dev/disk/by-id node as it was last examined: where it pointed, the mtime
+of the device node, and the device if it was found to be mountable.  A node is
+still valid if both the target and the mtime are unchanged. */
+typedef struct sCachedNode
+{
+    char *node;
+    char *target; // e.g. "/dev/sdb1"
+    time_t time;
+    Device *dev; // NULL if the node is not mountable
+} CachedNode;
+
+int get_cache_filename(char *buf, int size);
+CachedNode *load_device_cache(char *filename, int *count);
+int save_device_cache(char *filename, CachedNode *nodes, int count);
+void free_cached_nodes(CachedNode *nodes, int count);
+
+#endif
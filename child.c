@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "udev.h"
+#include "child.h"
+
+int child_timeouts[N_CHILD_CLASSES] =
+{
+    10000, // udevadm only reads the udev database
+    60000, // pmount may have to wait for a slow device to spin up
+    60000
+};
+
+static char *class_names[N_CHILD_CLASSES] =
+{
+    "udevadm",
+    "pmount",
+    "pumount"
+};
+
+/**
+Returns the current time of the monotonic clock in milliseconds.
+*/
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+/**
+Returns the name of a class of commands, as used by set_child_timeouts.
+*/
+char *child_class_name(ChildClass class)
+{
+    return class_names[class];
+}
+
+/**
+Sets the timeouts of command classes from a list like "pmount=30,udevadm=5",
+in seconds.  A timeout of 0 means no limit.  Returns 0 on success or -1 if the
+list could not be parsed; classes before the error keep their new values.
+*/
+int set_child_timeouts(char *spec)
+{
+    char *ptr = spec;
+
+    while(*ptr)
+    {
+        char *end;
+        double seconds;
+        int len;
+        int i;
+
+        end = strchr(ptr, '=');
+        if(!end)
+            return -1;
+        len = end-ptr;
+        for(i=0; i<N_CHILD_CLASSES; ++i)
+            if((int)strlen(class_names[i])==len && !strncmp(ptr, class_names[i], len))
+                break;
+        if(i==N_CHILD_CLASSES)
+            return -1;
+
+        ptr = end+1;
+        seconds = strtod(ptr, &end);
+        if(end==ptr || seconds<0 || (*end && *end!=','))
+            return -1;
+        child_timeouts[i] = seconds*1000;
+
+        ptr = (*end ? end+1 : end);
+    }
+
+    return 0;
+}
+
+/**
+Runs a command with its output going to a pipe.  argv[0] is the full path of
+the program.  The output of mount commands includes stderr, since it is shown
+to the user; udevadm's output is parsed, so its stderr is left alone.  Returns
+0 on success or -1 if the command could not be started.
+*/
+int start_child(Child *child, ChildClass class, char **argv)
+{
+    int pipe_fd[2];
+
+    memset(child, 0, sizeof(Child));
+    child->fd = -1;
+    child->class = class;
+    child->limit = CHILD_OUTPUT_LIMIT;
+    child->alloc = 1024;
+    child->output = (char *)malloc(child->alloc);
+    child->output[0] = 0;
+
+    if(pipe2(pipe_fd, O_CLOEXEC)==-1)
+        return -1;
+
+    if(verbosity>=2)
+    {
+        int i;
+        printf("Running");
+        for(i=0; argv[i]; ++i)
+            printf(" \"%s\"", argv[i]);
+        printf("\n");
+    }
+
+    child->pid = fork();
+    if(child->pid==0)
+    {
+        /* A group of its own, so that stopping the command also stops anything
+        it has started. */
+        setpgid(0, 0);
+        dup2(pipe_fd[1], 1);
+        if(class!=C_UDEVADM)
+            dup2(pipe_fd[1], 2);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(pipe_fd[1]);
+    if(child->pid<0)
+    {
+        close(pipe_fd[0]);
+        child->pid = 0;
+        return -1;
+    }
+    setpgid(child->pid, child->pid);
+
+    child->fd = pipe_fd[0];
+    fcntl(child->fd, F_SETFL, fcntl(child->fd, F_GETFL)|O_NONBLOCK);
+    if(child_timeouts[class]>0)
+        child->deadline = now_ms()+child_timeouts[class];
+
+    return 0;
+}
+
+/**
+Copies a NULL-terminated argument list, replacing %m in each argument with
+mountpoint and %% with %.  The result is freed with free_args.
+*/
+char **expand_mount_args(char **argv, char *mountpoint)
+{
+    char **args;
+    int mlen = strlen(mountpoint);
+    int n;
+    int i;
+
+    for(n=0; argv[n]; ++n) ;
+    args = (char **)malloc((n+1)*sizeof(char *));
+
+    for(i=0; i<n; ++i)
+    {
+        char *src;
+        char *dst;
+        int len = 0;
+
+        for(src=argv[i]; *src; ++src)
+        {
+            if(src[0]=='%' && src[1]=='m')
+            {
+                len += mlen;
+                ++src;
+            }
+            else
+            {
+                if(src[0]=='%' && src[1]=='%')
+                    ++src;
+                ++len;
+            }
+        }
+
+        args[i] = dst = (char *)malloc(len+1);
+        for(src=argv[i]; *src; ++src)
+        {
+            if(src[0]=='%' && src[1]=='m')
+            {
+                memcpy(dst, mountpoint, mlen);
+                dst += mlen;
+                ++src;
+            }
+            else
+            {
+                if(src[0]=='%' && src[1]=='%')
+                    ++src;
+                *dst++ = *src;
+            }
+        }
+        *dst = 0;
+    }
+    args[n] = NULL;
+
+    return args;
+}
+
+void free_args(char **args)
+{
+    int i;
+
+    for(i=0; args[i]; ++i)
+        free(args[i]);
+    free(args);
+}
+
+/**
+Starts an application in a directory, detached from us: it gets a session of
+its own and the default signal handling, so it is neither stopped with the
+window nor sent the window's signals.  argv[0] is looked up in PATH.  The
+caller still has to reap it.  Returns its pid, or -1 with errno set.
+*/
+pid_t spawn_detached(char **argv, char *directory)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    pid_t pid;
+    int err;
+
+    if(verbosity>=2)
+    {
+        int i;
+        printf("Starting");
+        for(i=0; argv[i]; ++i)
+            printf(" \"%s\"", argv[i]);
+        printf(" in %s\n", directory);
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addchdir_np(&actions, directory);
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+
+    err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if(err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return pid;
+}
+
+/**
+Reads whatever output of a child is available without blocking.  Output
+beyond the limit is dropped and the child marked as truncated.  Returns 1 at
+end of file, when the descriptor has been closed, or 0 otherwise.
+*/
+int collect_child_output(Child *child)
+{
+    char discard[4096];
+    int len;
+
+    while(child->fd!=-1)
+    {
+        if(child->len<child->limit)
+        {
+            if(child->len+1>=child->alloc)
+            {
+                child->alloc = (child->alloc*2<child->limit+1 ? child->alloc*2 : child->limit+1);
+                child->output = (char *)realloc(child->output, child->alloc);
+            }
+            len = read(child->fd, child->output+child->len, child->alloc-1-child->len);
+        }
+        else
+            len = read(child->fd, discard, sizeof(discard));
+
+        if(len>0)
+        {
+            if(child->len<child->limit)
+            {
+                child->len += len;
+                child->output[child->len] = 0;
+            }
+            else
+                child->truncated = 1;
+        }
+        else if(len<0 && errno==EINTR)
+            continue;
+        else if(len<0 && errno==EAGAIN)
+            return 0;
+        else
+        {
+            close(child->fd);
+            child->fd = -1;
+        }
+    }
+
+    return 1;
+}
+
+/**
+Reads some output of a child into buf, waiting until there is some, for
+callers that parse the output as it arrives.  Returns the number of bytes read,
+0 at end of file, or -1 on a read error or if the child has been stopped.
+*/
+int read_child(Child *child, char *buf, int size)
+{
+    while(child->fd!=-1 && child->stage==CHILD_RUNNING)
+    {
+        struct pollfd pfd;
+        int timeout;
+        int len;
+
+        timeout = check_child_deadline(child);
+        if(child->stage!=CHILD_RUNNING)
+            break;
+
+        pfd.fd = child->fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, timeout)<=0)
+            continue;
+
+        len = read(child->fd, buf, size);
+        if(len>0)
+            return len;
+        else if(len==0)
+        {
+            close(child->fd);
+            child->fd = -1;
+        }
+        else if(errno!=EAGAIN && errno!=EINTR)
+            return -1;
+    }
+
+    return (child->fd==-1 ? 0 : -1);
+}
+
+/**
+Sends a signal to a child and the processes it started.
+*/
+static void signal_child(Child *child, int sig)
+{
+    if(kill(-child->pid, sig)==-1)
+        kill(child->pid, sig);
+}
+
+/**
+Asks a child to stop, as when the user cancels it.  If it hasn't exited within
+CHILD_KILL_GRACE_MS, check_child_deadline kills it.
+*/
+void stop_child(Child *child)
+{
+    if(child->exited || child->stage!=CHILD_RUNNING)
+        return;
+
+    child->cancelled = 1;
+    signal_child(child, SIGTERM);
+    child->stage = CHILD_TERMINATED;
+    child->deadline = now_ms()+CHILD_KILL_GRACE_MS;
+}
+
+/**
+Takes the next step against a child that has run past its deadline: SIGTERM
+first, then SIGKILL, and finally giving up on it.  Returns the number of
+milliseconds until the next step is due, or -1 if there is none.
+*/
+int check_child_deadline(Child *child)
+{
+    long long now;
+
+    if(child->exited || !child->deadline)
+        return -1;
+
+    now = now_ms();
+    if(now<child->deadline)
+        return child->deadline-now;
+
+    switch(child->stage)
+    {
+    case CHILD_RUNNING:
+        if(verbosity>=1)
+            printf("%s did not finish in time, stopping it\n", class_names[child->class]);
+        child->timed_out = 1;
+        signal_child(child, SIGTERM);
+        child->stage = CHILD_TERMINATED;
+        break;
+    case CHILD_TERMINATED:
+        if(verbosity>=1)
+            printf("%s did not stop, killing it\n", class_names[child->class]);
+        signal_child(child, SIGKILL);
+        child->stage = CHILD_KILLED;
+        break;
+    default:
+        if(verbosity>=1)
+            printf("%s could not be killed, giving up on it\n", class_names[child->class]);
+        child->stage = CHILD_ABANDONED;
+        child->deadline = 0;
+        return -1;
+    }
+
+    child->deadline = now+CHILD_KILL_GRACE_MS;
+    return CHILD_KILL_GRACE_MS;
+}
+
+/**
+Collects the rest of a child's output and waits for it to exit, stopping it if
+it runs past its deadline.  Returns 0 once the child has exited, or -1 if it
+had to be abandoned because not even SIGKILL ended it, as happens to processes
+stuck in the kernel on a failing device.
+*/
+int wait_child(Child *child)
+{
+    while(!child->exited)
+    {
+        int timeout;
+
+        timeout = check_child_deadline(child);
+        if(child->stage==CHILD_ABANDONED)
+            return -1;
+
+        if(child->fd!=-1)
+        {
+            struct pollfd pfd;
+
+            pfd.fd = child->fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, timeout);
+            collect_child_output(child);
+        }
+        else
+        {
+            pid_t result;
+
+            result = waitpid(child->pid, &child->status, (timeout<0 ? 0 : WNOHANG));
+            if(result==child->pid)
+                child->exited = 1;
+            else if(result==0)
+                usleep((timeout<50 ? timeout : 50)*1000);
+            else if(errno!=EINTR)
+            {
+                /* Reaped by someone else; the status is lost. */
+                child->status = W_EXITCODE(255, 0);
+                child->exited = 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+Returns nonzero if a child has exited with status 0.
+*/
+int child_succeeded(Child *child)
+{
+    return child->exited && WIFEXITED(child->status) && !WEXITSTATUS(child->status);
+}
+
+/**
+Describes why a child did not succeed, without its output.
+*/
+void describe_child_failure(Child *child, char *buf, int size)
+{
+    char *name = class_names[child->class];
+
+    if(child->timed_out)
+        snprintf(buf, size, "%s did not finish within %g seconds", name, child_timeouts[child->class]/1000.0);
+    else if(child->cancelled)
+        snprintf(buf, size, "%s was cancelled", name);
+    else if(!child->exited)
+        snprintf(buf, size, "%s is not responding", name);
+    else if(WIFSIGNALED(child->status))
+        snprintf(buf, size, "%s was terminated by signal %d", name, WTERMSIG(child->status));
+    else if(WIFEXITED(child->status) && WEXITSTATUS(child->status)==127)
+        snprintf(buf, size, "could not run %s", name);
+    else if(WIFEXITED(child->status))
+        snprintf(buf, size, "%s failed with status %d", name, WEXITSTATUS(child->status));
+    else
+        snprintf(buf, size, "%s failed", name);
+
+    if(child->stage==CHILD_ABANDONED && strlen(buf)+30<(size_t)size)
+        strcat(buf, " and could not be stopped");
+}
+
+/**
+Frees the output of a child and closes its pipe.  The process itself must
+have been waited for already, or be left to whoever reaps it.
+*/
+void free_child(Child *child)
+{
+    if(child->fd!=-1)
+        close(child->fd);
+    child->fd = -1;
+    free(child->output);
+    child->output = NULL;
+}
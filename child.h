@@ -0,0 +1,70 @@
+#ifndef CHILD_H
+#define CHILD_H
+
+#include <sys/types.h>
+
+/* Kinds of external command.  Each has its own timeout. */
+typedef enum
+{
+    C_UDEVADM, // udevadm info
+    C_MOUNT, // pmount
+    C_UNMOUNT, // pumount
+    N_CHILD_CLASSES
+} ChildClass;
+
+/* Milliseconds a command of each class may run before it is stopped, or 0 for
+no limit. */
+extern int child_timeouts[N_CHILD_CLASSES];
+
+/* How long a stopped command gets to exit after SIGTERM, and after SIGKILL,
+before it is given up on. */
+#define CHILD_KILL_GRACE_MS 2000
+
+/* Output kept by default; anything beyond is read and dropped. */
+#define CHILD_OUTPUT_LIMIT 65536
+
+typedef enum
+{
+    CHILD_RUNNING,
+    CHILD_TERMINATED, // SIGTERM sent
+    CHILD_KILLED, // SIGKILL sent
+    CHILD_ABANDONED // did not die even from SIGKILL
+} ChildStage;
+
+/* A running command.  Its stdout and stderr both go to fd, which is
+non-blocking and is closed and set to -1 at end of file.  Collected output is
+kept in output, up to limit bytes. */
+typedef struct sChild
+{
+    pid_t pid;
+    int fd;
+    ChildClass class;
+    ChildStage stage;
+    long long deadline; // monotonic ms of the next escalation, 0 for none
+    int timed_out;
+    int cancelled;
+    char *output; // NUL-terminated
+    int len;
+    int alloc;
+    int limit;
+    int truncated;
+    int exited;
+    int status; // from waitpid, once exited
+} Child;
+
+char *child_class_name(ChildClass class);
+int set_child_timeouts(char *spec);
+int start_child(Child *child, ChildClass class, char **argv);
+char **expand_mount_args(char **argv, char *mountpoint);
+void free_args(char **args);
+pid_t spawn_detached(char **argv, char *directory);
+int collect_child_output(Child *child);
+int read_child(Child *child, char *buf, int size);
+void stop_child(Child *child);
+int check_child_deadline(Child *child);
+int wait_child(Child *child);
+int child_succeeded(Child *child);
+void describe_child_failure(Child *child, char *buf, int size);
+void free_child(Child *child);
+
+#endif
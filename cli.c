@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "devices.h"
+#include "trace.h"
+#include "writeback.h"
+#include "warmup.h"
+
+/* Output goes here.  Our stdout is pointed at stderr, so that diagnostics and
+the output of pmount don't get mixed into the JSON. */
+FILE *out;
+
+/**
+Returns the time in milliseconds on the monotonic clock.
+*/
+double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+/**
+Writes a device as a JSON object.
+*/
+void print_device(Device *dev)
+{
+    MountProfile *profile;
+    char buf[256];
+
+    fputs("{\"node\": ", out);
+    write_json_string(out, dev->node);
+    if(dev->link && strcmp(dev->link, dev->node))
+    {
+        fputs(", \"link\": ", out);
+        write_json_string(out, dev->link);
+    }
+    fputs(", \"label\": ", out);
+    write_json_string(out, dev->label);
+    fputs(", \"shortdev\": ", out);
+    write_json_string(out, dev->shortdev);
+    fputs(", \"description\": ", out);
+    write_json_string(out, dev->description);
+    fprintf(out, ", \"mounted\": %s", (dev->mounted ? "true" : "false"));
+    fputs(", \"mountpoint\": ", out);
+    write_json_string(out, dev->mountpoint);
+    if(dev->rule)
+        fprintf(out, ", \"rule\": %d, \"action\": \"%s\"", dev->rule, rule_action_name(dev->action));
+    profile = match_profile(mount_profiles, dev->uuid, dev->serial, dev->fs_type);
+    if(profile)
+    {
+        describe_profile(profile, buf, sizeof(buf));
+        fputs(", \"profile\": ", out);
+        write_json_string(out, profile->key);
+        fputs(", \"options\": ", out);
+        write_json_string(out, buf);
+    }
+    fputc('}', out);
+}
+
+/**
+Writes an array of devices as a JSON array.
+*/
+void print_devices(Device **devices)
+{
+    int i;
+
+    fputc('[', out);
+    for(i=0; (devices && devices[i]); ++i)
+    {
+        fputs((i ? ",\n " : "\n "), out);
+        print_device(devices[i]);
+    }
+    fputs((i ? "\n]\n" : "]\n"), out);
+}
+
+/**
+Prints the automount rule each device matches, without acting on it.
+*/
+void print_rules(Device **devices, char *rules_file)
+{
+    int i;
+
+    if(!automount_rules)
+        fprintf(out, "no rules in %s\n", rules_file);
+    for(i=0; (devices && devices[i]); ++i)
+    {
+        Device *dev = devices[i];
+
+        if(dev->rule)
+            fprintf(out, "%s %s: line %d, %s\n", dev->shortdev, dev->label, dev->rule, rule_action_name(dev->action));
+        else
+            fprintf(out, "%s %s: no rule\n", dev->shortdev, dev->label);
+    }
+}
+
+/**
+Finds the device with a given by-id path, label, short name or /dev name.
+Returns NULL and complains if there is no such device or the name is
+ambiguous.
+*/
+Device *find_device(Device **devices, char *name)
+{
+    Device *found = NULL;
+    int i;
+
+    for(i=0; (devices && devices[i]); ++i)
+    {
+        Device *dev = devices[i];
+        if(strcmp(dev->node, name) && (!dev->link || strcmp(dev->link, name)) && strcmp(dev->label, name)
+            && strcmp(dev->shortdev, name) && strcmp(dev->devname, name))
+            continue;
+
+        if(found)
+        {
+            fprintf(stderr, "%s matches more than one device\n", name);
+            return NULL;
+        }
+        found = dev;
+    }
+
+    if(!found)
+        fprintf(stderr, "no mountable device %s\n", name);
+
+    return found;
+}
+
+/**
+Mounts or unmounts a device and waits for the command to finish.  The device
+is updated with the resulting mount state.  Returns the exit status.
+*/
+int run_mount_command(Device *dev, int mounting)
+{
+    MountEntry *me;
+    Child child;
+    char buf[256];
+    int status;
+    double start;
+
+    if(dev->mounted==mounting)
+    {
+        if(verbosity>=1)
+            printf("%s is already %s\n", dev->shortdev, (mounting ? "mounted" : "unmounted"));
+        return 0;
+    }
+
+    /* Write back the data first, so that a failing device shows up as a
+    flush error rather than a hanging pumount. */
+    if(!mounting && dev->mountpoint)
+    {
+        if(verbosity>=1)
+            printf("Flushing %s\n", dev->mountpoint);
+        start = trace_now();
+        if(sync_mountpoint(dev->mountpoint)<0)
+            fprintf(stderr, "could not flush %s, unmounting anyway\n", dev->mountpoint);
+        trace_span(T_FLUSH, start, dev->node);
+    }
+
+    start = trace_now();
+    if(start_mount_command(&child, dev, mounting)<0)
+    {
+        fprintf(stderr, "could not start %s\n", (mounting ? "pmount" : "pumount"));
+        free_child(&child);
+        return 1;
+    }
+
+    wait_child(&child);
+    trace_span(T_MOUNT_COMMAND, start, dev->node);
+    fputs(child.output, stderr);
+    if(child.truncated)
+        fprintf(stderr, "(output truncated)\n");
+    if(!child.exited || child.timed_out || !WIFEXITED(child.status))
+    {
+        describe_child_failure(&child, buf, sizeof(buf));
+        fprintf(stderr, "%s\n", buf);
+        free_child(&child);
+        return 1;
+    }
+    status = WEXITSTATUS(child.status);
+    if(status && !child.len)
+    {
+        describe_child_failure(&child, buf, sizeof(buf));
+        fprintf(stderr, "%s\n", buf);
+    }
+    free_child(&child);
+
+    mount_state_loaded = 0;
+    load_mount_state();
+    me = find_mount(mount_table, dev->devnum);
+    free(dev->mountpoint);
+    dev->mountpoint = (me ? strdup(me->mountpoint) : NULL);
+    dev->mounted = (me!=NULL);
+
+    if(mounting && dev->mountpoint && warmup_enabled)
+    {
+        WarmupStats stats;
+
+        start = trace_now();
+        warm_up_mountpoint(dev->mountpoint, &warmup_limits, &stats);
+        trace_span(T_WARMUP, start, dev->mountpoint);
+        describe_warmup(&stats, buf, sizeof(buf));
+        fprintf(stderr, "%s\n", buf);
+    }
+
+    return status;
+}
+
+void usage(FILE *file, char *argv0)
+{
+    fprintf(file, "usage: %s [options] list\n", argv0);
+    fprintf(file, "       %s [options] mount|unmount device\n", argv0);
+    fprintf(file, "       %s [options] rules\n", argv0);
+    fprintf(file, "devices are given by /dev/disk/by-id path, label or\n");
+    fprintf(file, "short name (e.g. sdb1); rules shows the automount rule\n");
+    fprintf(file, "each device matches without mounting anything\n");
+    fprintf(file, "-v verbosity  -h help!  -t print elapsed time\n");
+    fprintf(file, "-R root (read /dev, /sys and /run/udev below root,\n");
+    fprintf(file, "for testing against a fixture directory)\n");
+    fprintf(file, "-S dir (read sysfs from dir instead of /sys)\n");
+    fprintf(file, "-c enumerate the block devices in sysfs instead of\n");
+    fprintf(file, "/dev/disk/by-id\n");
+    fprintf(file, "-e enumerate with one udevadm info --export-db\n");
+    fprintf(file, "-E file (as -e but read a saved --export-db dump)\n");
+    fprintf(file, "-T file (write a Chrome trace of the time spent in\n");
+    fprintf(file, "each stage)  -s print a summary of the stages at exit\n");
+    fprintf(file, "-w class=seconds,... (timeouts of the udevadm, pmount\n");
+    fprintf(file, "and pumount commands, 0 for none)\n");
+    fprintf(file, "-a file (read automount rules from file instead of\n");
+    fprintf(file, "~/.config/pmount-gui-ng/rules)\n");
+    fprintf(file, "-P file (read mount options from file instead of\n");
+    fprintf(file, "~/.config/pmount-gui-ng/profiles)\n");
+    fprintf(file, "-W on|depth=n,entries=n,ms=n,threads=n (read the\n");
+    fprintf(file, "directories of a new mount into the cache)\n");
+}
+
+int main(int argc, char** argv)
+{
+    double start = get_time_ms();
+    int show_time = 0;
+    int show_summary = 0;
+    char trace_file[1024];
+    char rules_file[1024];
+    char profiles_file[1024];
+    Device **devices = NULL;
+    Device *dev = NULL;
+    char *command;
+    int status = 0;
+    int opt;
+
+    trace_file[0] = 0;
+    rules_file[0] = 0;
+    profiles_file[0] = 0;
+    out = fdopen(dup(1), "w");
+    dup2(2, 1);
+
+    while((opt = getopt(argc, argv, "vhtsT:R:S:ceE:w:a:W:P:"))!=-1) switch(opt)
+        {
+        case 'v':
+            ++verbosity;
+            break;
+        case 't':
+            show_time = 1;
+            break;
+        case 's':
+            show_summary = 1;
+            break;
+        case 'T':
+            snprintf(trace_file,sizeof(trace_file),"%s",optarg);
+            break;
+        case 'e':
+            use_export_db = 1;
+            break;
+        case 'E':
+            use_export_db = 1;
+            snprintf(export_db_file,sizeof(export_db_file),"%s",optarg);
+            break;
+        case 'R':
+            snprintf(sysroot,sizeof(sysroot),"%s",optarg);
+            break;
+        case 'S':
+            snprintf(sysfs_root,sizeof(sysfs_root),"%s",optarg);
+            break;
+        case 'c':
+            use_sysfs_enumeration = 1;
+            break;
+        case 'w':
+            if(set_child_timeouts(optarg)<0)
+            {
+                fprintf(stderr, "invalid timeouts %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'a':
+            snprintf(rules_file,sizeof(rules_file),"%s",optarg);
+            break;
+        case 'P':
+            snprintf(profiles_file,sizeof(profiles_file),"%s",optarg);
+            break;
+        case 'W':
+            if(set_warmup_limits(optarg)<0)
+            {
+                fprintf(stderr, "invalid warm-up limits %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'h':
+            usage(out, argv[0]);
+            fflush(out);
+            return 0;
+        case '?':
+            if (optopt == 'R' || optopt == 'S' || optopt == 'E' || optopt == 'T' || optopt == 'w' || optopt == 'a' || optopt == 'W' || optopt == 'P')
+                fprintf (stderr, "option -%c requires an argument.\n", optopt);
+            else if (isprint (optopt))
+                fprintf (stderr, "unknown option `-%c'.\n", optopt);
+            else
+                fprintf (stderr,
+                         "unknown option `\\x%x'.\n",
+                         optopt);
+            return 2;
+        }
+
+    if(show_summary || trace_file[0])
+        start_tracing();
+    if(rules_file[0] || get_rules_filename(rules_file, sizeof(rules_file))==0)
+        automount_rules = load_rules(rules_file);
+    if(profiles_file[0] || get_profiles_filename(profiles_file, sizeof(profiles_file))==0)
+        mount_profiles = load_profiles(profiles_file);
+
+    if(optind>=argc)
+    {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+    command = argv[optind];
+
+    if(!strcmp(command, "list"))
+    {
+        if(optind+1!=argc)
+        {
+            usage(stderr, argv[0]);
+            return 2;
+        }
+        devices = get_devices();
+        print_devices(devices);
+    }
+    else if(!strcmp(command, "rules"))
+    {
+        if(optind+1!=argc)
+        {
+            usage(stderr, argv[0]);
+            return 2;
+        }
+        devices = get_devices();
+        print_rules(devices, rules_file);
+    }
+    else if(!strcmp(command, "mount") || !strcmp(command, "unmount"))
+    {
+        if(optind+2!=argc)
+        {
+            usage(stderr, argv[0]);
+            return 2;
+        }
+        devices = get_devices();
+        dev = find_device(devices, argv[optind+1]);
+        if(dev)
+        {
+            status = run_mount_command(dev, !strcmp(command, "mount"));
+            print_device(dev);
+            fputc('\n', out);
+        }
+        else
+            status = 1;
+    }
+    else
+    {
+        fprintf(stderr, "unknown command %s\n", command);
+        return 2;
+    }
+
+    fflush(out);
+    if(show_time)
+        fprintf(stderr, "%.3f ms\n", get_time_ms()-start);
+    if(show_summary)
+        print_trace_summary(stderr);
+    if(trace_file[0] && write_trace(trace_file)<0)
+        fprintf(stderr, "can't write %s\n", trace_file);
+    free_trace();
+
+    free_devices(devices);
+    free_mount_table(mount_table);
+    unref_fstab_set(fstab_set);
+    free_rules(automount_rules);
+    free_profiles(mount_profiles);
+
+    return status;
+}
@@ -0,0 +1,669 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "devices.h"
+#include "trace.h"
+
+int verbosity = 0;
+
+int use_export_db = 0;
+char export_db_file[1024];
+int use_sysfs_enumeration = 0;
+
+MountTable *mount_table = NULL;
+FstabSet *fstab_set = NULL;
+int mounts_watched = 0;
+int mount_state_loaded = 0;
+
+int is_in_array(char **names, char *devname)
+{
+    int i;
+    if(!names || !devname)
+        return 0;
+    for(i=0; names[i]; ++i)
+        if(!strcmp(devname, names[i]))
+            return 1;
+    return 0;
+}
+
+void free_device_names(char **names)
+{
+    int i;
+    if(!names)
+        return;
+    for(i=0; names[i]; ++i)
+        free(names[i]);
+    free(names);
+}
+
+/**
+Reads fstab again, replacing fstab_set.  Threads still holding a reference to
+the previous set keep using it.
+*/
+void reload_fstab_set(void)
+{
+    char fnbuf[1024];
+
+    unref_fstab_set(fstab_set);
+    snprintf(fnbuf, sizeof(fnbuf), "%s/etc/fstab", sysroot);
+    fstab_set = load_fstab_set(fnbuf);
+}
+
+/**
+Makes sure mount_table and fstab_set reflect the current state of the
+system.
+*/
+void load_mount_state(void)
+{
+    char fnbuf[1024];
+    double start;
+
+    if(mounts_watched && mount_state_loaded)
+        return;
+    mount_state_loaded = 1;
+
+    start = trace_now();
+    snprintf(fnbuf, sizeof(fnbuf), "%s/proc/self/mountinfo", sysroot);
+    free_mount_table(mount_table);
+    mount_table = read_mount_table(fnbuf);
+
+    reload_fstab_set();
+    trace_span(T_MOUNT_TABLE, start, NULL);
+}
+
+/**
+Check if an array of properties describes a device that can be mounted.
+Devices with a user-mountable entry in the allowed set always can be.  Sysfs
+lookups go through the given cache.
+*/
+int can_mount(PropertySet *props, FstabSet *allowed, SysfsCache *sysfs)
+{
+    static char *removable_buses[] = { "usb", "firewire", 0 };
+    char *devpath;
+    char *bus;
+
+    if(fstab_allows(allowed, props))
+        return 1;
+
+    /* Special case for CD devices, since they are not partitions.  Only allow
+    mounting if media is inserted. */
+    if(match_atom_value(props, P_ID_TYPE, "cd") && match_atom_value(props, P_ID_CDROM_MEDIA, "1"))
+        return 1;
+
+    /* Only allow mounting partitions. */
+    if(!match_atom_value(props, P_DEVTYPE, "partition"))
+        return 0;
+
+    devpath = get_atom_value(props, P_DEVPATH);
+    if(is_removable(sysfs, devpath))
+        return 1;
+
+    /* Certain buses are removable by nature, but devices only advertise
+    themselves as removable if they support removable media, e.g. memory card
+    readers. */
+    bus = get_atom_value(props, P_ID_BUS);
+    if(is_in_array(removable_buses, bus))
+        return 1;
+
+    return check_buses(sysfs, devpath, removable_buses);
+}
+
+/* Link targets already seen by get_device_nodes, in an open-addressing table
+that doubles when it gets half full. */
+typedef struct sNameSet
+{
+    char **slots;
+    int n_slots;
+    int n_names;
+} NameSet;
+
+/**
+Hashes a name for the set.
+*/
+static unsigned hash_name(char *str)
+{
+    unsigned hash = 2166136261u;
+
+    for(; *str; ++str)
+        hash = (hash^(unsigned char)*str)*16777619u;
+
+    return hash;
+}
+
+static void insert_name(char **slots, int n_slots, char *name)
+{
+    unsigned mask = n_slots-1;
+    unsigned slot = hash_name(name)&mask;
+
+    while(slots[slot])
+        slot = (slot+1)&mask;
+    slots[slot] = name;
+}
+
+/**
+Adds a copy of a name to the set.  Returns 1 if it was added, 0 if it was
+already there.
+*/
+static int add_name(NameSet *set, char *name)
+{
+    unsigned mask;
+    unsigned slot;
+    int i;
+
+    if((set->n_names+1)*2>set->n_slots)
+    {
+        int n_slots = (set->n_slots ? set->n_slots*2 : 64);
+        char **slots = (char **)calloc(n_slots, sizeof(char *));
+
+        for(i=0; i<set->n_slots; ++i)
+            if(set->slots[i])
+                insert_name(slots, n_slots, set->slots[i]);
+        free(set->slots);
+        set->slots = slots;
+        set->n_slots = n_slots;
+    }
+
+    mask = set->n_slots-1;
+    for(slot=hash_name(name)&mask; set->slots[slot]; slot=(slot+1)&mask)
+        if(!strcmp(set->slots[slot], name))
+            return 0;
+
+    set->slots[slot] = strdup(name);
+    ++set->n_names;
+
+    return 1;
+}
+
+static void clear_names(NameSet *set)
+{
+    int i;
+
+    for(i=0; i<set->n_slots; ++i)
+        free(set->slots[i]);
+    free(set->slots);
+}
+
+/**
+Returns an array of all device nodes in a directory.  Symbolic links are
+dereferenced.
+*/
+char **get_device_nodes(char *dirname)
+{
+    DIR *dir;
+    struct dirent *de;
+    char fnbuf[256];
+    char linkbuf[256];
+    struct stat st;
+    char **nodes = NULL;
+    int n_nodes = 0;
+    int n_alloc = 0;
+    NameSet checked = { NULL, 0, 0 };
+
+    dir = opendir(dirname);
+    if(!dir)
+        return NULL;
+
+    while((de = readdir(dir)))
+    {
+        char *node;
+
+        /* Ignore . and .. entries. */
+        if(de->d_name[0]=='.' && (de->d_name[1]==0 || (de->d_name[1]=='.' && de->d_name[2]==0)))
+            continue;
+
+        snprintf(fnbuf, sizeof(fnbuf), "%s/%s", dirname, de->d_name);
+
+        node = fnbuf;
+        lstat(fnbuf, &st);
+        if(S_ISLNK(st.st_mode))
+        {
+            int len;
+            len = readlink(fnbuf, linkbuf, sizeof(linkbuf)-1);
+            if(len!=-1)
+            {
+                linkbuf[len] = 0;
+                node = linkbuf;
+            }
+        }
+
+        /* There may be multiple symlinks to the same device.  Only include each
+        device once in the returned array. */
+        if(!add_name(&checked, node))
+        {
+            if(verbosity>=2)
+                printf("Device %s is a duplicate\n", fnbuf);
+            continue;
+        }
+
+        if(n_nodes+2>n_alloc)
+        {
+            n_alloc = (n_alloc ? n_alloc*2 : 16);
+            nodes = (char **)realloc(nodes, n_alloc*sizeof(char *));
+        }
+        nodes[n_nodes] = strdup(fnbuf);
+        ++n_nodes;
+    }
+
+    closedir(dir);
+    clear_names(&checked);
+
+    if(nodes)
+        nodes[n_nodes] = NULL;
+
+    return nodes;
+}
+
+/**
+Returns an array of device nodes for the block devices in /sys/class/block
+that contain a medium.  This lists each device once, by device number, without
+looking at every link in /dev.  Devices are named by their /dev name; the
+by-id link that identifies them comes from udev's DEVLINKS when they are
+examined.
+*/
+char **get_block_nodes(void)
+{
+    BlockDevice *blocks;
+    char **nodes = NULL;
+    int n_blocks;
+    int n_nodes = 0;
+    int n_alloc = 0;
+    int i;
+
+    blocks = list_block_devices(&n_blocks);
+    if(!blocks)
+        return NULL;
+
+    for(i=0; i<n_blocks; ++i)
+    {
+        char fnbuf[1100];
+
+        /* Partitions of an empty card reader, unused loop devices etc. */
+        if(!blocks[i].size)
+            continue;
+
+        if(n_nodes+2>n_alloc)
+        {
+            n_alloc = (n_alloc ? n_alloc*2 : 16);
+            nodes = (char **)realloc(nodes, n_alloc*sizeof(char *));
+        }
+        snprintf(fnbuf, sizeof(fnbuf), "%s/dev/%s", sysroot, blocks[i].name);
+        nodes[n_nodes++] = strdup(fnbuf);
+    }
+    free_block_devices(blocks, n_blocks);
+
+    if(nodes)
+        nodes[n_nodes] = NULL;
+
+    return nodes;
+}
+
+/**
+Lists the device nodes to examine, using the chosen enumeration.
+*/
+char **list_device_nodes(void)
+{
+    char dirname[1024];
+    char **nodes;
+    double start;
+
+    start = trace_now();
+    if(use_sysfs_enumeration)
+    {
+        nodes = get_block_nodes();
+        trace_span(T_SCAN, start, "class/block");
+    }
+    else
+    {
+        snprintf(dirname, sizeof(dirname), "%s/dev/disk/by-id", sysroot);
+        nodes = get_device_nodes(dirname);
+        trace_span(T_SCAN, start, dirname);
+    }
+
+    return nodes;
+}
+
+/**
+Finds the /dev name a device node symlink points to, e.g. /dev/sdb1 for a link
+to ../../sdb1.  Returns 0 on success or -1 if the node is not a symlink.
+*/
+int get_link_devname(char *node, char *buf, int size)
+{
+    char linkbuf[1024];
+    char *name;
+    char *ptr;
+    int len;
+
+    len = readlink(node, linkbuf, sizeof(linkbuf)-1);
+    if(len==-1)
+        return -1;
+    linkbuf[len] = 0;
+
+    name = linkbuf;
+    for(ptr=name; *ptr; ++ptr)
+        if(*ptr=='/')
+            name = ptr+1;
+    snprintf(buf, size, "/dev/%s", name);
+
+    return 0;
+}
+
+/**
+Picks the link a device is known by from the DEVLINKS property: the first of
+its /dev/disk/by-id links in sort order, below sysroot.  Returns a new string,
+or NULL if udev lists no such link.
+*/
+static char *get_id_link(PropertySet *props)
+{
+    static const char prefix[] = "/dev/disk/by-id/";
+    char *devlinks = get_atom_value(props, P_DEVLINKS);
+    char *best = NULL;
+    int best_len = 0;
+    char *ptr;
+    char *link;
+
+    for(ptr=devlinks; ptr && *ptr; )
+    {
+        int len = strcspn(ptr, " ");
+
+        if(len>(int)sizeof(prefix)-1 && !strncmp(ptr, prefix, sizeof(prefix)-1))
+        {
+            int cmp = (best ? strncmp(ptr, best, (len<best_len ? len : best_len)) : -1);
+            if(cmp<0 || (!cmp && len<best_len))
+            {
+                best = ptr;
+                best_len = len;
+            }
+        }
+        ptr += len;
+        ptr += strspn(ptr, " ");
+    }
+
+    if(!best)
+        return NULL;
+
+    link = (char *)malloc(strlen(sysroot)+best_len+1);
+    sprintf(link, "%s%.*s", sysroot, best_len, best);
+
+    return link;
+}
+
+/**
+Examines a set of device nodes and passes each mountable device to a callback
+as soon as it is found.  Devices in the allowed set are always mountable.  The
+array of nodes is terminated by a NULL entry.  The mount state of the
+devices is left for the caller to fill in, so this uses no shared state and can
+run in a thread of its own.
+*/
+void examine_nodes_with(char **nodes, FstabSet *allowed, DeviceCallback found, void *data)
+{
+    UdevIndex *index = NULL;
+    SysfsCache *sysfs;
+    int i;
+
+    if(!nodes || !nodes[0])
+        return;
+    sysfs = new_sysfs_cache();
+
+    if(use_export_db)
+    {
+        double start = trace_now();
+        index = load_udev_index(export_db_file[0] ? export_db_file : NULL);
+        trace_span(T_PROPERTIES, start, "export-db");
+        if(!index && verbosity>=1)
+            printf("Could not load the udev database, examining devices separately\n");
+    }
+
+    for(i=0; nodes[i]; ++i)
+    {
+        PropertySet *props;
+        double start;
+        int mountable;
+
+        if(verbosity>=1)
+            printf("Examining device %s\n", nodes[i]);
+
+        start = trace_now();
+        if(index)
+            props = udev_index_lookup_node(index, nodes[i]);
+        else
+            props = get_device_properties(nodes[i]);
+        trace_span(T_PROPERTIES, start, nodes[i]);
+        if(!props || !get_atom_value(props, P_DEVNAME))
+        {
+            if(verbosity>=2)
+                printf("  No properties\n");
+            if(!index)
+                free_properties(props);
+            continue;
+        }
+
+        if(verbosity>=2)
+        {
+            int j;
+            for(j=0; j<props->n_props; ++j)
+                printf("  %s = %s\n", props->props[j].name, props->props[j].value);
+        }
+
+
+        start = trace_now();
+        mountable = can_mount(props, allowed, sysfs);
+        trace_span(T_SYSFS, start, nodes[i]);
+
+        if(mountable)
+        {
+            Device *dev;
+            char *devname;
+            char *label;
+            char *vendor;
+            char *model;
+            char *major;
+            char *minor;
+            char buf[256];
+            int pos;
+            Rule *rule;
+            struct stat st;
+
+            if(verbosity>=1)
+                printf("  Using device\n");
+
+            devname = get_atom_value(props, P_DEVNAME);
+
+
+            /* Get a human-readable label for the device.  Use filesystem label,
+            filesystem UUID or device node name in order of preference. */
+            label = get_atom_value(props, P_ID_FS_LABEL);
+            if(!label)
+                label = get_atom_value(props, P_ID_FS_UUID);
+            if(!label)
+            {
+                char *ptr;
+
+                label = devname;
+                for(ptr=label; *ptr; ++ptr)
+                    if(*ptr=='/')
+                        label = ptr+1;
+            }
+
+            vendor = get_atom_value(props, P_ID_VENDOR);
+            model = get_atom_value(props, P_ID_MODEL);
+
+            pos = snprintf(buf, sizeof(buf), "%s", label);
+            if(vendor && model)
+                pos += snprintf(buf+pos, sizeof(buf)-pos, " (%s %s)", vendor, model);
+
+            stat(nodes[i], &st);
+
+            dev = (Device *)calloc(1, sizeof(Device));
+            dev->node = strdup(nodes[i]);
+            dev->link = get_id_link(props);
+            dev->devname = strdup(devname);
+            dev->label = strdup(label);
+            dev->description = strdup(buf);
+            major = get_atom_value(props, P_MAJOR);
+            minor = get_atom_value(props, P_MINOR);
+            if(major && minor)
+                dev->devnum = makedev(atoi(major), atoi(minor));
+            dev->time = st.st_mtime;
+            char* s = strrchr(devname,'/');
+            s++;
+            char* sd = strdup(s);
+            dev->shortdev = sd;
+            dev->uuid = get_atom_value(props, P_ID_FS_UUID);
+            dev->serial = get_atom_value(props, P_ID_SERIAL);
+            dev->fs_type = get_atom_value(props, P_ID_FS_TYPE);
+            dev->uuid = (dev->uuid ? strdup(dev->uuid) : NULL);
+            dev->serial = (dev->serial ? strdup(dev->serial) : NULL);
+            dev->fs_type = (dev->fs_type ? strdup(dev->fs_type) : NULL);
+
+            rule = match_rules(automount_rules, props);
+            if(rule)
+            {
+                dev->rule = rule->line;
+                dev->action = rule->action;
+                if(verbosity>=1)
+                    printf("  Matches rule on line %d: %s\n", rule->line, rule_action_name(rule->action));
+            }
+
+            found(dev, data);
+        }
+        if(!index)
+            free_properties(props);
+    }
+
+    free_udev_index(index);
+    free_sysfs_cache(sysfs);
+}
+
+/* A growing array of devices, for collecting the results of
+examine_nodes_with. */
+typedef struct sDeviceArray
+{
+    Device **devices;
+    int n_devices;
+} DeviceArray;
+
+static void append_device(Device *dev, void *data)
+{
+    DeviceArray *array = (DeviceArray *)data;
+
+    /* Reserve space for a sentinel entry. */
+    array->devices = (Device **)realloc(array->devices, (array->n_devices+2)*sizeof(Device *));
+    array->devices[array->n_devices++] = dev;
+    array->devices[array->n_devices] = NULL;
+}
+
+/**
+Examines a set of device nodes and returns an array of the mountable devices
+among them, with their mount state.  Both arrays are terminated by a NULL
+entry.  The node strings are copied.
+*/
+Device **examine_nodes(char **nodes)
+{
+    DeviceArray array = { NULL, 0 };
+    int i;
+
+    if(!nodes || !nodes[0])
+        return NULL;
+    load_mount_state();
+
+    examine_nodes_with(nodes, fstab_set, append_device, &array);
+    for(i=0; i<array.n_devices; ++i)
+    {
+        Device *dev = array.devices[i];
+        MountEntry *me = (dev->devnum ? find_mount(mount_table, dev->devnum) : NULL);
+        dev->mounted = (me!=NULL);
+        dev->mountpoint = (me ? strdup(me->mountpoint) : NULL);
+    }
+
+    return array.devices;
+}
+
+
+
+/** Returns an array of all mountable devices. */
+Device **get_devices(void)
+{
+    char **nodes;
+    Device **devices;
+
+    nodes = list_device_nodes();
+    devices = examine_nodes(nodes);
+    free_device_names(nodes);
+
+    return devices;
+}
+
+/**
+Starts pmount or pumount for a device as a child with the timeout of its
+class.  The command's output and errors are collected in the child.  pmount
+gets the options of the device's mount profile, and read-only too if its
+automount rule says readonly.  Returns 0 on success or -1 if the command could
+not be started.
+*/
+int start_mount_command(Child *child, Device *dev, int mounting)
+{
+    char mountingpoint[1024];
+    char *argv[4+MAX_PROFILE_ARGS];
+    int argc = 0;
+
+    snprintf(mountingpoint,1024,"%s-%s",dev->shortdev,dev->label);
+
+    if (mounting) {
+        MountProfile *profile = match_profile(mount_profiles, dev->uuid, dev->serial, dev->fs_type);
+        MountProfile options;
+
+        if (profile)
+            options = *profile;
+        else
+            memset(&options, 0, sizeof(options));
+        if (dev->action==ACTION_READ_ONLY)
+            options.read_only = 1;
+
+        argv[argc++] = "/usr/bin/pmount";
+        argc = add_profile_args(&options, argv, argc);
+        argv[argc++] = dev->node;
+        argv[argc++] = mountingpoint;
+        argv[argc] = NULL;
+    } else {
+        argv[0] = "/usr/bin/pumount";
+        argv[1] = dev->node;
+        argv[2] = NULL;
+    }
+
+    return start_child(child, (mounting ? C_MOUNT : C_UNMOUNT), argv);
+}
+
+/**
+Frees a device and all strings contained in it.
+*/
+void free_device(Device *dev)
+{
+    free(dev->node);
+    free(dev->link);
+    free(dev->devname);
+    free(dev->label);
+    free(dev->description);
+    free(dev->shortdev);
+    free(dev->mountpoint);
+    free(dev->uuid);
+    free(dev->serial);
+    free(dev->fs_type);
+    free(dev);
+}
+
+/**
+Frees an array of devices and the devices in it.
+*/
+void free_devices(Device **devices)
+{
+    int i;
+    if(!devices)
+        return;
+    for(i=0; devices[i]; ++i)
+        free_device(devices[i]);
+    free(devices);
+}
@@ -0,0 +1,72 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "udev.h"
+#include "mounts.h"
+#include "sysfs.h"
+#include "child.h"
+#include "fstab.h"
+#include "rules.h"
+#include "profiles.h"
+
+/* A mountable device.  The row and job fields belong to the GUI and stay NULL
+elsewhere. */
+typedef struct sDevice
+{
+    char *node; // "/dev/disk/by-id/<a_symlink>", or "/dev/sdb1" with -c
+    char *link; // its first /dev/disk/by-id link, NULL if it has none
+    char *devname; // e.g. "/dev/sda1"
+    char *label; // label of the filesystem
+    char *description;
+    int mounted;
+    char *mountpoint; // where the device is mounted, if it is
+    dev_t devnum;
+    time_t time;
+    void *row; // GtkTreeIter of the device's row in the GUI's list
+    char *shortdev; // e.g. sda1 for device /dev/sda1
+    struct sMountJob *job; // mount or unmount in progress
+    int rule; // line of the automount rule that matched, 0 for none
+    RuleAction action; // of that rule
+    char *uuid; // ID_FS_UUID, ID_SERIAL and ID_FS_TYPE, which pick the mount
+    char *serial; // profile; NULL if udev doesn't know them
+    char *fs_type;
+} Device;
+
+/* Enumerate with a single udevadm info --export-db instead of looking up each
+device separately.  export_db_file names a saved dump to read instead. */
+extern int use_export_db;
+extern char export_db_file[1024];
+
+/* Enumerate the block devices in sysfs instead of the links in
+/dev/disk/by-id. */
+extern int use_sysfs_enumeration;
+
+/* Mount state shared by all enumerations.  When the files are being watched
+the tables are kept up to date by the watchers; otherwise they are read again
+for every enumeration. */
+extern MountTable *mount_table;
+extern FstabSet *fstab_set;
+extern int mounts_watched;
+extern int mount_state_loaded;
+
+typedef void (*DeviceCallback)(Device *dev, void *data);
+
+int is_in_array(char **names, char *devname);
+void free_device_names(char **names);
+void reload_fstab_set(void);
+void load_mount_state(void);
+int can_mount(PropertySet *props, FstabSet *allowed, SysfsCache *sysfs);
+char **get_device_nodes(char *dirname);
+char **get_block_nodes(void);
+char **list_device_nodes(void);
+int get_link_devname(char *node, char *buf, int size);
+void examine_nodes_with(char **nodes, FstabSet *allowed, DeviceCallback found, void *data);
+Device **examine_nodes(char **nodes);
+Device **get_devices(void);
+int start_mount_command(Child *child, Device *dev, int mounting);
+void free_device(Device *dev);
+void free_devices(Device **devices);
+
+#endif
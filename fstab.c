@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <mntent.h>
+#include <sys/sysmacros.h>
+#include "fstab.h"
+
+/* Tags that fstab accepts in place of a device path.  Values of the UUID tags
+are compared case-insensitively, since vfat UUIDs are often written either way. */
+static char *uuid_tags[] = { "UUID=", "PARTUUID=", NULL };
+
+/**
+Hashes a string for the key table.
+*/
+static unsigned hash_key(char *str)
+{
+    unsigned hash = 2166136261u;
+
+    for(; *str; ++str)
+        hash = (hash^(unsigned char)*str)*16777619u;
+
+    return hash;
+}
+
+/**
+Hashes a device number for the device number table.
+*/
+static unsigned hash_devnum(dev_t devnum)
+{
+    unsigned long long h = (unsigned long long)devnum*0x9E3779B97F4A7C15ULL;
+
+    return (unsigned)(h>>32);
+}
+
+/**
+Returns the smallest power of two that leaves a table with count entries at
+most half full.
+*/
+static int table_size(int count)
+{
+    int size = 8;
+
+    while(size<count*2)
+        size *= 2;
+
+    return size;
+}
+
+/**
+Writes the key for an fstab source to buf: the source itself, with quotes
+around a tag's value removed and UUIDs in lower case.
+*/
+static void make_key(char *source, char *buf, int size)
+{
+    char *value;
+    int prefix;
+    int len;
+    int i;
+
+    value = strchr(source, '=');
+    if(source[0]=='/' || !value)
+    {
+        snprintf(buf, size, "%s", source);
+        return;
+    }
+
+    ++value;
+    prefix = value-source;
+    len = strlen(value);
+    if(len>=2 && value[0]=='"' && value[len-1]=='"')
+    {
+        ++value;
+        len -= 2;
+    }
+    snprintf(buf, size, "%.*s%.*s", prefix, source, len, value);
+
+    for(i=0; uuid_tags[i]; ++i)
+        if(!strncmp(buf, uuid_tags[i], strlen(uuid_tags[i])))
+        {
+            char *ptr;
+            for(ptr=buf+strlen(uuid_tags[i]); *ptr; ++ptr)
+                *ptr = tolower((unsigned char)*ptr);
+        }
+}
+
+static void insert_key(FstabSet *set, char *key)
+{
+    unsigned mask = set->n_key_slots-1;
+    unsigned slot = hash_key(key)&mask;
+
+    while(set->keys[slot])
+    {
+        if(!strcmp(set->keys[slot], key))
+            return;
+        slot = (slot+1)&mask;
+    }
+    set->keys[slot] = strdup(key);
+}
+
+static void insert_devnum(FstabSet *set, dev_t devnum)
+{
+    unsigned mask = set->n_devnum_slots-1;
+    unsigned slot = hash_devnum(devnum)&mask;
+
+    while(set->devnums[slot])
+    {
+        if(set->devnums[slot]==devnum)
+            return;
+        slot = (slot+1)&mask;
+    }
+    set->devnums[slot] = devnum;
+}
+
+/**
+Reads the user-mountable entries of an fstab file, usually /etc/fstab.  Device
+paths are resolved to device numbers if the device is present; tags and
+absent devices are matched by key later.  Returns an empty set if the file
+could not be read.
+*/
+FstabSet *load_fstab_set(char *filename)
+{
+    FstabSet *set;
+    FILE *file;
+    struct mntent *me;
+    char **keys = NULL;
+    dev_t *devnums = NULL;
+    int n_keys = 0;
+    int n_devnums = 0;
+    int i;
+
+    file = setmntent(filename, "r");
+    if(file)
+    {
+        while((me = getmntent(file)))
+        {
+            char key[1024];
+            char fnbuf[1100];
+            char numbuf[32];
+            unsigned maj;
+            unsigned min;
+
+            if(!hasmntopt(me, "user"))
+                continue;
+
+            make_key(me->mnt_fsname, key, sizeof(key));
+            keys = (char **)realloc(keys, (n_keys+1)*sizeof(char *));
+            keys[n_keys++] = strdup(key);
+
+            if(key[0]!='/')
+                continue;
+            snprintf(fnbuf, sizeof(fnbuf), "%s%s", sysroot, key);
+            if(get_node_devnum(fnbuf, numbuf, sizeof(numbuf))==0 && sscanf(numbuf, "%u:%u", &maj, &min)==2)
+            {
+                devnums = (dev_t *)realloc(devnums, (n_devnums+1)*sizeof(dev_t));
+                devnums[n_devnums++] = makedev(maj, min);
+            }
+        }
+        endmntent(file);
+    }
+
+    set = (FstabSet *)calloc(1, sizeof(FstabSet));
+    set->refs = 1;
+    set->n_entries = n_keys;
+    set->n_key_slots = table_size(n_keys);
+    set->keys = (char **)calloc(set->n_key_slots, sizeof(char *));
+    set->n_devnum_slots = table_size(n_devnums);
+    set->devnums = (dev_t *)calloc(set->n_devnum_slots, sizeof(dev_t));
+
+    for(i=0; i<n_keys; ++i)
+    {
+        insert_key(set, keys[i]);
+        free(keys[i]);
+    }
+    for(i=0; i<n_devnums; ++i)
+        insert_devnum(set, devnums[i]);
+    free(keys);
+    free(devnums);
+
+    if(verbosity>=2)
+        printf("%d user-mountable entries in %s, %d of them present\n", n_keys, filename, n_devnums);
+
+    return set;
+}
+
+/**
+Takes another reference to a set, for use by another thread.
+*/
+FstabSet *ref_fstab_set(FstabSet *set)
+{
+    if(set)
+        __sync_add_and_fetch(&set->refs, 1);
+
+    return set;
+}
+
+/**
+Drops a reference to a set, freeing it with the last one.
+*/
+void unref_fstab_set(FstabSet *set)
+{
+    int i;
+
+    if(!set || __sync_sub_and_fetch(&set->refs, 1))
+        return;
+
+    for(i=0; i<set->n_key_slots; ++i)
+        free(set->keys[i]);
+    free(set->keys);
+    free(set->devnums);
+    free(set);
+}
+
+int fstab_set_has_key(FstabSet *set, char *key)
+{
+    unsigned mask = set->n_key_slots-1;
+    unsigned slot = hash_key(key)&mask;
+
+    for(; set->keys[slot]; slot=(slot+1)&mask)
+        if(!strcmp(set->keys[slot], key))
+            return 1;
+
+    return 0;
+}
+
+int fstab_set_has_devnum(FstabSet *set, dev_t devnum)
+{
+    unsigned mask = set->n_devnum_slots-1;
+    unsigned slot = hash_devnum(devnum)&mask;
+
+    for(; set->devnums[slot]; slot=(slot+1)&mask)
+        if(set->devnums[slot]==devnum)
+            return 1;
+
+    return 0;
+}
+
+/**
+Checks for a tag entry, e.g. LABEL=STICK, with the given value.
+*/
+static int has_tag(FstabSet *set, char *tag, char *value)
+{
+    char source[1024];
+    char key[1024];
+
+    if(!value || !value[0])
+        return 0;
+
+    snprintf(source, sizeof(source), "%s%s", tag, value);
+    make_key(source, key, sizeof(key));
+
+    return fstab_set_has_key(set, key);
+}
+
+/**
+Undoes the \xNN escapes udev uses in *_ENC properties.
+*/
+static void decode_udev_string(char *str, char *buf, int size)
+{
+    int len = 0;
+
+    for(; (*str && len<size-1); ++str)
+    {
+        unsigned c;
+        if(str[0]=='\\' && str[1]=='x' && sscanf(str+2, "%2x", &c)==1 && isxdigit((unsigned char)str[3]))
+        {
+            buf[len++] = c;
+            str += 3;
+        }
+        else
+            buf[len++] = *str;
+    }
+    buf[len] = 0;
+}
+
+/**
+Checks if fstab has a user-mountable entry for a device, under any of its
+names: device number, DEVNAME, the symlinks in DEVLINKS, or its filesystem
+and partition UUIDs and labels.
+*/
+int fstab_allows(FstabSet *set, PropertySet *props)
+{
+    char *value;
+    char *major_str;
+    char *minor_str;
+    char buf[1024];
+
+    if(!set || !set->n_entries)
+        return 0;
+
+    major_str = get_atom_value(props, P_MAJOR);
+    minor_str = get_atom_value(props, P_MINOR);
+    if(major_str && minor_str && fstab_set_has_devnum(set, makedev(atoi(major_str), atoi(minor_str))))
+        return 1;
+
+    value = get_atom_value(props, P_DEVNAME);
+    if(value && fstab_set_has_key(set, value))
+        return 1;
+
+    value = get_atom_value(props, P_DEVLINKS);
+    while(value && *value)
+    {
+        int len = strcspn(value, " ");
+        if(len>0 && len<(int)sizeof(buf))
+        {
+            memcpy(buf, value, len);
+            buf[len] = 0;
+            if(fstab_set_has_key(set, buf))
+                return 1;
+        }
+        value += len;
+        value += strspn(value, " ");
+    }
+
+    /* ID_FS_LABEL has unsafe characters replaced; the encoded form keeps
+    them. */
+    value = get_atom_value(props, P_ID_FS_LABEL_ENC);
+    if(value)
+    {
+        decode_udev_string(value, buf, sizeof(buf));
+        value = buf;
+    }
+    else
+        value = get_atom_value(props, P_ID_FS_LABEL);
+
+    return has_tag(set, "UUID=", get_atom_value(props, P_ID_FS_UUID))
+        || has_tag(set, "LABEL=", value)
+        || has_tag(set, "PARTUUID=", get_atom_value(props, P_ID_PART_ENTRY_UUID))
+        || has_tag(set, "PARTLABEL=", get_atom_value(props, P_ID_PART_ENTRY_NAME));
+}
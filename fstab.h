@@ -0,0 +1,30 @@
+#ifndef FSTAB_H
+#define FSTAB_H
+
+#include <sys/types.h>
+#include "udev.h"
+
+/* Devices that fstab lets users mount.  Entries are hashed two ways: by the
+device number of entries that could be resolved when fstab was read, and by
+key, which is the source as written ("/dev/disk/by-id/...") or a tag like
+"UUID=...".  Keys let devices that were plugged in later still match their
+UUID=, LABEL= or /dev/disk/by-* entries.  A set never changes once loaded and
+is shared between threads by reference counting. */
+typedef struct sFstabSet
+{
+    char **keys; // open addressing, NULL for empty slots
+    int n_key_slots;
+    dev_t *devnums; // likewise, 0 for empty slots
+    int n_devnum_slots;
+    int n_entries;
+    int refs;
+} FstabSet;
+
+FstabSet *load_fstab_set(char *filename);
+FstabSet *ref_fstab_set(FstabSet *set);
+void unref_fstab_set(FstabSet *set);
+int fstab_set_has_key(FstabSet *set, char *key);
+int fstab_set_has_devnum(FstabSet *set, dev_t devnum);
+int fstab_allows(FstabSet *set, PropertySet *props);
+
+#endif
@@ -3,887 +3,2224 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <dirent.h>
-#include <mntent.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <sys/wait.h>
-#include <sys/select.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
+#include <glib-unix.h>
 #include <ctype.h>
+#include <errno.h>
+#include "udev.h"
+#include "uevent.h"
+#include "mounts.h"
+#include "devices.h"
+#include "trace.h"
+#include "cache.h"
+#include "writeback.h"
+#include "warmup.h"
 
-typedef struct sProperty
-{
-    char *name;
-    char *value;
-} Property;
-
-typedef struct sDevice
-{
-    char *node; // "/dev/disk/by-id/<a_symlink>"
-    char *label; // label of the filesystem
-    char *description;
-    int mounted;
-    time_t time;
-    GtkWidget* toggle;
-    char *shortdev; // e.g. sda1 for device /dev/sda1
-} Device;
-
-int verbosity = 0;
 int okfeedback = FALSE;
-int hasMounted = FALSE;
-Device *devices;
+Device **devices; // NULL terminated
+int n_devices = 0;
+int n_devices_alloc = 0;
 GtkWidget* window;
 
 char filemanager[1024];
+gchar **app_argv = NULL; // filemanager split into arguments
+char profiles_file[1024]; // where edited mount profiles are saved, or empty
+
+/* The device list is a GtkListStore holding a pointer to each device and the
+status shown next to it.  Row text is formatted when a row is drawn, so only
+the visible rows cost anything, and the filter box hides rows through a
+GtkTreeModelFilter without touching the store. */
+enum { COL_DEVICE, COL_STATUS, N_COLUMNS };
+
+GtkListStore* device_store;
+GtkTreeModel* device_filter; // the rows the view shows
+GtkWidget* device_view;
+GtkWidget* filter_entry;
+char filter_text[256]; // in lower case
+
+void set_device_mount(Device *dev, MountEntry *me);
+
+/* Size and free space of mounted filesystems, by mountpoint.  statvfs can hang
+on a device that has stopped responding, so it runs in worker threads, and a
+filesystem whose statvfs takes longer than SPACE_TIMEOUT_MS is shown as
+unresponsive until it answers.  Space is read again every SPACE_REFRESH_S
+seconds and whenever the mount table changes. */
+#define SPACE_TIMEOUT_MS 2000
+#define SPACE_REFRESH_S 30
+
+typedef struct sSpaceEntry
+{
+    MountSpace space;
+    int valid; // space has been read
+    int querying; // a statvfs is running
+    int unresponsive; // and has been running for too long
+} SpaceEntry;
+
+GHashTable *space_entries = NULL; // mountpoint -> SpaceEntry
+
+// describes the space on a device's filesystem, if it's mounted and known
+void format_device_space(Device* dev, char* buf, int size) {
+    SpaceEntry *entry = NULL;
+    char used[32];
+    char total[32];
+    char avail[32];
+
+    buf[0] = 0;
+    if (dev->mounted && dev->mountpoint && space_entries)
+        entry = (SpaceEntry *)g_hash_table_lookup(space_entries, dev->mountpoint);
+    if (!entry)
+        return;
 
-/**
-Parses a string of the form name=value and places the components in a Property
-structure.  Returns 0 on success, or -1 if the string wasn't a valid property.
-*/
-int parse_property(char *str, int size, Property *prop)
+    if (entry->unresponsive)
+        snprintf(buf, size, "unresponsive");
+    else if (entry->valid) {
+        format_size(entry->space.used, used, sizeof(used));
+        format_size(entry->space.size, total, sizeof(total));
+        format_size(entry->space.avail, avail, sizeof(avail));
+        snprintf(buf, size, "%s of %s used, %s free", used, total, avail);
+    }
+}
+
+// redraws a device's row after its mount state or space changed
+void update_device_row(Device* dev) {
+    GtkTreePath *path;
+
+    if (!dev->row)
+        return;
+    path = gtk_tree_model_get_path(GTK_TREE_MODEL(device_store), (GtkTreeIter *)dev->row);
+    gtk_tree_model_row_changed(GTK_TREE_MODEL(device_store), path, (GtkTreeIter *)dev->row);
+    gtk_tree_path_free(path);
+}
+
+// sets the status shown in a device's row; without one the space on a mounted
+// device is shown
+void set_device_label(Device* dev, char* status) {
+    if (dev->row)
+        gtk_list_store_set(device_store, (GtkTreeIter *)dev->row, COL_STATUS, status, -1);
+}
+
+/* A statvfs running in a worker thread.  Both its result and its timeout are
+delivered to the main loop, and whichever comes last frees it. */
+typedef struct sSpaceQuery
 {
-    int equals = -1;
+    char *mountpoint;
+    MountSpace space;
+    int result;
+    int done;
+    int refs;
+} SpaceQuery;
+
+void unref_space_query(SpaceQuery* query) {
+    if (--query->refs)
+        return;
+    free(query->mountpoint);
+    free(query);
+}
+
+// updates the rows of devices mounted on a directory
+void relabel_mountpoint(char* mountpoint) {
     int i;
+    for (i=0; devices && devices[i]; ++i)
+        if (devices[i]->mounted && devices[i]->mountpoint && !devices[i]->job && !strcmp(devices[i]->mountpoint, mountpoint))
+            set_device_label(devices[i], NULL);
+}
 
-    for(i=0; (equals<0 && i<size); ++i)
-        if(str[i]=='=')
-            equals = i;
+gboolean on_space_result(gpointer user_data) {
+    SpaceQuery *query = (SpaceQuery *)user_data;
+    SpaceEntry *entry = (SpaceEntry *)g_hash_table_lookup(space_entries, query->mountpoint);
+
+    query->done = TRUE;
+    if (entry) {
+        entry->querying = FALSE;
+        entry->unresponsive = FALSE;
+        if (query->result==0) {
+            entry->space = query->space;
+            entry->valid = TRUE;
+        }
+        relabel_mountpoint(query->mountpoint);
+    }
+    unref_space_query(query);
 
-    if(equals<0)
-        return -1;
+    return FALSE;
+}
 
-    prop->name = malloc(equals+1);
-    strncpy(prop->name, str, equals);
-    prop->name[equals] = 0;
+gboolean on_space_timeout(gpointer user_data) {
+    SpaceQuery *query = (SpaceQuery *)user_data;
 
-    prop->value = malloc(size-equals);
-    strncpy(prop->value, str+equals+1, size-equals-1);
-    prop->value[size-equals-1] = 0;
+    if (!query->done) {
+        SpaceEntry *entry = (SpaceEntry *)g_hash_table_lookup(space_entries, query->mountpoint);
+        if (verbosity>=1)
+            printf("%s is not responding\n", query->mountpoint);
+        if (entry) {
+            entry->unresponsive = TRUE;
+            relabel_mountpoint(query->mountpoint);
+        }
+    }
+    unref_space_query(query);
 
-    return 0;
+    return FALSE;
 }
 
-/**
-Retrieves all properties associated with a /dev node.  The returned array is
-terminated with an entry containing NULL values.  Use free_properties to free
-the array.
-*/
-Property *get_device_properties(char *node)
-{
-    int pid;
-    int pipe_fd[2];
+gpointer space_thread(gpointer data) {
+    SpaceQuery *query = (SpaceQuery *)data;
 
-    pipe(pipe_fd);
+    query->result = get_mount_space(query->mountpoint, &query->space);
+    g_idle_add(on_space_result, query);
 
-    pid = fork();
-    if(pid==0)
-    {
-        if(verbosity>=2)
-            printf("Running udevadm info -q property -n \"%s\"\n", node);
+    return NULL;
+}
 
-        close(pipe_fd[0]);
-        dup2(pipe_fd[1], 1);
+// starts reading the space on a mounted device, unless that is underway
+void query_device_space(Device* dev) {
+    SpaceEntry *entry;
+    SpaceQuery *query;
 
-        execl("/sbin/udevadm", "udevadm", "info", "-q", "property", "-n", node, NULL);
-        _exit(1);
+    if (!dev->mounted || !dev->mountpoint)
+        return;
+    if (!space_entries)
+        space_entries = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+
+    entry = (SpaceEntry *)g_hash_table_lookup(space_entries, dev->mountpoint);
+    if (!entry) {
+        entry = (SpaceEntry *)calloc(1, sizeof(SpaceEntry));
+        g_hash_table_insert(space_entries, strdup(dev->mountpoint), entry);
     }
-    else if(pid>0)
-    {
-        char *buf;
-        int bufsize;
-        int pos = 0;
-        int eof = 0;
-        Property *props = NULL;
-        int n_props = 0;
+    // a hanging device would otherwise collect a thread on every refresh
+    if (entry->querying)
+        return;
+    entry->querying = TRUE;
 
-        close(pipe_fd[1]);
+    query = (SpaceQuery *)calloc(1, sizeof(SpaceQuery));
+    query->mountpoint = strdup(dev->mountpoint);
+    query->refs = 2;
+    g_timeout_add(SPACE_TIMEOUT_MS, on_space_timeout, query);
+    g_thread_unref(g_thread_new("space", space_thread, query));
+}
 
-        bufsize = 256;
-        buf = (char *)malloc(bufsize);
+// reads the space on all mounted devices again, and forgets filesystems that
+// are no longer mounted
+gboolean refresh_space(gpointer user_data) {
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    int i;
 
-        while(1)
-        {
-            int newline;
-            int i;
-            Property prop;
-
-            if(!eof)
-            {
-                int len;
-
-                len = read(pipe_fd[0], buf+pos, bufsize-pos);
-                if(len==0)
-                    eof = 1;
-                else if(len==-1)
-                    break;
-                pos += len;
-            }
-
-            newline = -1;
-            for(i=0; (newline<0 && i<pos); ++i)
-                if(buf[i]=='\n')
-                    newline = i;
-
-            if(newline<0)
-            {
-                if(eof)
-                    break;
-                bufsize *= 2;
-                buf = (char *)realloc(buf, bufsize);
+    if (space_entries) {
+        g_hash_table_iter_init(&iter, space_entries);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            int mounted = FALSE;
+            if (((SpaceEntry *)value)->querying)
                 continue;
-            }
-
-            if(parse_property(buf, newline, &prop)==0)
-            {
-                props = (Property *)realloc(props, (n_props+2)*sizeof(Property));
-                props[n_props] = prop;
-                ++n_props;
-
-                memmove(buf, buf+newline+1, pos-newline-1);
-                pos -= newline+1;
-            }
-            else
-                break;
+            for (i=0; !mounted && devices && devices[i]; ++i)
+                mounted = (devices[i]->mounted && devices[i]->mountpoint && !strcmp(devices[i]->mountpoint, (char *)key));
+            if (!mounted)
+                g_hash_table_iter_remove(&iter);
         }
+    }
 
-        free(buf);
+    for (i=0; devices && devices[i]; ++i)
+        query_device_space(devices[i]);
 
-        if(props)
-        {
-            props[n_props].name = NULL;
-            props[n_props].value = NULL;
-        }
+    return G_SOURCE_CONTINUE;
+}
 
-        waitpid(pid, NULL, 0);
-        close(pipe_fd[0]);
+// shows a message that goes away when acknowledged
+void show_message(int type, char* text) {
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT, type, GTK_BUTTONS_OK, "%s", text);
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show_all(dialog);
+}
 
-        return props;
+/* A running pmount or pumount.  Jobs run in the background while the main loop
+keeps going, so several devices can be mounted at once.  The device may go away
+while its job runs, in which case dev is cleared and the copies of its label,
+node and name are used instead.  An unmount first flushes the filesystem from a
+worker thread, so pumount doesn't sit in the kernel writing back data without
+feedback.  Clicking the row of a job offers to cancel it; the command is
+stopped, but a flush can't be interrupted, so a cancelled unmount just doesn't
+run pumount once the flush is done. */
+typedef struct sMountJob
+{
+    Device *dev;
+    int mounting;
+    char *label;
+    char *node;
+    char *shortdev;
+    RuleAction action; // of the device's rule, which may make the mount read-only
+    char *uuid; // to find the mount profile
+    char *serial;
+    char *fs_type;
+    char *mountpoint; // set while flushing
+    int flush_result;
+    guint progress_timer;
+    long long start_sectors; // sectors written by the device before the flush
+    Child child; // the command, once it has been started
+    guint deadline_timer;
+    int cancelled;
+    GtkWidget *cancel_dialog;
+    double started; // trace time the current stage was started
+} MountJob;
+
+int n_jobs = 0; // jobs that haven't been freed yet
+int quit_pending = FALSE; // quit once the last job is over
+
+// ends the application once the jobs that kept it running are over
+gboolean on_jobs_done(gpointer user_data) {
+    if (quit_pending && !n_jobs) {
+        if (verbosity>=1)
+            printf("last job is over, quitting\n");
+        gtk_widget_destroy(window);
     }
-    else
-    {
-        close(pipe_fd[0]);
-        close(pipe_fd[1]);
+    return FALSE;
+}
 
-        return NULL;
-    }
+void free_job(MountJob *job)
+{
+    --n_jobs;
+    if(!n_jobs && quit_pending)
+        g_idle_add(on_jobs_done, NULL);
+    if(job->deadline_timer)
+        g_source_remove(job->deadline_timer);
+    if(job->cancel_dialog)
+        gtk_widget_destroy(job->cancel_dialog);
+    free_child(&job->child);
+    free(job->label);
+    free(job->node);
+    free(job->shortdev);
+    free(job->uuid);
+    free(job->serial);
+    free(job->fs_type);
+    free(job->mountpoint);
+    free(job);
 }
 
+/* A warm-up of a new mount that runs before the file manager is started. */
+typedef struct sWarmupJob
+{
+    char *mountpoint;
+    WarmupStats stats;
+    double started;
+} WarmupJob;
+
 /**
-Looks for a property in an array of properties and returns its value.  Returns
-NULL if the property was not found.
+Reaps the -f application once it exits.
 */
-char *get_property_value(Property *props, char *name)
+void on_application_exited(GPid pid, gint status, gpointer user_data)
 {
-    int i;
-    for(i=0; props[i].name; ++i)
-        if(strcmp(props[i].name, name)==0)
-            return props[i].value;
-    return NULL;
+    g_spawn_close_pid(pid);
+    if(verbosity>=1)
+        printf("%s exited with status %04X\n", app_argv[0], status);
 }
 
 /**
-Checks if a property has a specific value.  A NULL value is matched if the
-property does not exist.
+Starts the -f application in a new mountpoint.  It runs on its own, and the
+window stays up for the next device.
 */
-int match_property_value(Property *props, char *name, char *value)
-{
-    char *v = get_property_value(props, name);
-    if(!v)
-        return value==NULL;
-    return strcmp(v, value)==0;
+void start_application(char *mountpoint) {
+    char **args = expand_mount_args(app_argv, mountpoint);
+    pid_t pid = spawn_detached(args, mountpoint);
+
+    if (pid<0) {
+        char buf[1100];
+        snprintf(buf,sizeof(buf),"Could not start %s: %s",args[0],strerror(errno));
+        show_message(GTK_MESSAGE_ERROR, buf);
+    } else
+        g_child_watch_add(pid, on_application_exited, NULL);
+    free_args(args);
 }
 
 /**
-Frees an array of properties and all strings contained in it.
+Called in the main loop when a warm-up has finished or run out of time.
 */
-void free_properties(Property *props)
+gboolean on_warmup_done(gpointer user_data)
 {
-    int i;
-    if(!props)
-        return;
-    for(i=0; props[i].name; ++i)
+    WarmupJob *wj = (WarmupJob *)user_data;
+
+    trace_span(T_WARMUP, wj->started, wj->mountpoint);
+    if(verbosity>=1)
     {
-        free(props[i].name);
-        free(props[i].value);
+        char buf[256];
+        describe_warmup(&wj->stats, buf, sizeof(buf));
+        printf("%s: %s\n", wj->mountpoint, buf);
     }
-    free(props);
-}
+    start_application(wj->mountpoint);
 
-/**
-Reads device names from an fstab/mtab file.
-*/
-char **get_mount_entries(char *filename, int (*predicate)(struct mntent *))
-{
-    FILE *file;
-    struct mntent *me;
-    char **devices = NULL;
-    int n_devices = 0;
+    free(wj->mountpoint);
+    free(wj);
 
-    file = setmntent(filename, "r");
-    if(!file)
-        return NULL;
+    return G_SOURCE_REMOVE;
+}
 
-    while((me = getmntent(file)))
-        if(!predicate || predicate(me))
-        {
-            devices = (char **)realloc(devices, (n_devices+2)*sizeof(char *));
-            devices[n_devices] = strdup(me->mnt_fsname);
-            ++n_devices;
-        }
+gpointer warmup_job_thread(gpointer data)
+{
+    WarmupJob *wj = (WarmupJob *)data;
 
-    endmntent(file);
-    if(devices)
-        devices[n_devices] = NULL;
+    warm_up_mountpoint(wj->mountpoint, &warmup_limits, &wj->stats);
+    g_idle_add(on_warmup_done, wj);
 
-    return devices;
+    return NULL;
 }
 
 /**
-Returns an array of all currently mounted devices.
+Starts reading the directories of a device that has just been mounted, so the
+file manager finds them in the cache.  The -f application is started once
+that is done.
 */
-char **get_mounted_devices(void)
+void start_warmup(char *mountpoint)
 {
-    return get_mount_entries("/etc/mtab", NULL);
+    WarmupJob *wj;
+
+    wj = (WarmupJob *)calloc(1, sizeof(WarmupJob));
+    wj->mountpoint = strdup(mountpoint);
+    wj->started = trace_now();
+    g_thread_unref(g_thread_new("warm-up", warmup_job_thread, wj));
 }
 
 /**
-Checks if an fstab entry has the user option set.
+Opens a device that has just been mounted with the -f application, after
+warming it up if -W was given.
 */
-int is_user_mountable(struct mntent *me)
+void open_new_mount(Device *dev)
 {
-    return hasmntopt(me, "user")!=NULL;
+    char fnbuf[1100];
+    MountTable *table;
+    MountEntry *me;
+
+    // the path is needed now, but the shared table belongs to the mountinfo
+    // watcher, which has to see the change to update the row, so read a copy
+    snprintf(fnbuf,sizeof(fnbuf),"%s/proc/self/mountinfo",sysroot);
+    table = read_mount_table(fnbuf);
+    me = (table ? find_mount(table, dev->devnum) : NULL);
+    if(!me) {
+        char buf[1100];
+        snprintf(buf,sizeof(buf),"Could not find where %s was mounted",dev->label);
+        show_message(GTK_MESSAGE_ERROR, buf);
+    } else if (warmup_enabled)
+        start_warmup(me->mountpoint);
+    else
+        start_application(me->mountpoint);
+    free_mount_table(table);
 }
 
 /**
-Returns an array of user-mountable devices listed in fstab.
+Reports the result of a job once the command has exited and all of its output
+has been read.
 */
-char **get_fstab_devices(void)
-{
-    return get_mount_entries("/etc/fstab", &is_user_mountable);
-}
-
-int is_in_array(char **names, char *devname)
+void finish_job(MountJob *job)
 {
-    int i;
-    if(!names || !devname)
-        return 0;
-    for(i=0; names[i]; ++i)
-        if(!strcmp(devname, names[i]))
-            return 1;
-    return 0;
-}
+    char buf[1100];
+    int status = job->child.status;
 
-void free_device_names(char **names)
-{
-    int i;
-    if(!names)
+    if(!job->child.exited || job->child.fd!=-1)
         return;
-    for(i=0; names[i]; ++i)
-        free(names[i]);
-    free(names);
-}
 
-/**
-Checks if a partition identified by a sysfs path is on a removable device.
-*/
-int is_removable(char *devpath)
-{
-    char fnbuf[256];
-    int len;
-    char *ptr;
-    int fd;
+    if(verbosity>=1)
+    {
+        if(WIFEXITED(status))
+        {
+            if(WEXITSTATUS(status))
+                printf("Command exited with status %d\n", WEXITSTATUS(status));
+            else
+                printf("Command exited successfully\n");
+        }
+        else if(WIFSIGNALED(status))
+            printf("Command terminated with signal %d\n", WTERMSIG(status));
+        else
+            printf("Command exited with unknown result %04X\n", status);
+    }
 
-    len = snprintf(fnbuf, sizeof(fnbuf), "/sys%s", devpath);
-    /* Default to not removable if the path was too long. */
-    if(len+10>=(int)sizeof(fnbuf))
-        return 0;
+    if(job->dev)
+    {
+        Device *dev = job->dev;
+        dev->job = NULL;
+        // put the check mark back if the command failed; after a success the
+        // mountinfo watcher reports the new state, if there is one
+        load_mount_state();
+        if(!mounts_watched || !WIFEXITED(status) || WEXITSTATUS(status))
+            set_device_mount(dev, find_mount(mount_table, dev->devnum));
+        // the data has been written and the device unmounted
+        if(!job->mounting && WIFEXITED(status) && !WEXITSTATUS(status))
+            set_device_label(dev, "safe to remove");
+        else
+            set_device_label(dev, NULL);
+    }
 
-    /* We got a partition as a parameter, but the removable property is on the
-    disk.  Replace the last component with "removable". */
-    for(ptr=fnbuf+len; (ptr>fnbuf && *ptr!='/'); --ptr) ;
-    strcpy(ptr, "/removable");
+    if(WIFEXITED(status) && !WEXITSTATUS(status) && job->mounting && app_argv && job->dev)
+        open_new_mount(job->dev);
 
-    fd = open(fnbuf, O_RDONLY);
-    if(fd!=-1)
+    // give error message or alternativly confirm that mount or unmount
+    // did actually happen... a cancelled job needs no explanation
+    if(!child_succeeded(&job->child) && !job->cancelled)
     {
-        char c;
-        read(fd, &c, 1);
-        close(fd);
-        if(c=='1')
-        {
-            if(verbosity>=2)
-                printf("  Removable\n");
-            return 1;
-        }
-        if(verbosity>=2)
-            printf("  Not removable\n");
+        // the command's own explanation is the most useful, but not if it was
+        // stopped before it could give one
+        char *message = (char *)malloc(sizeof(buf)+job->child.len+32);
+        describe_child_failure(&job->child, buf, sizeof(buf));
+        if(!job->child.len)
+            strcpy(message, buf);
+        else if(job->child.timed_out)
+            sprintf(message, "%s\n\n%s", buf, job->child.output);
+        else
+            strcpy(message, job->child.output);
+        if(job->child.truncated)
+            strcat(message, "\n(output truncated)");
+        show_message(GTK_MESSAGE_ERROR, message);
+        free(message);
+    }
+    else if (okfeedback==TRUE) {
+        if (job->mounting)
+            snprintf(buf,sizeof(buf),"%s mounted ok %s",job->label,job->node);
+        else
+            snprintf(buf,sizeof(buf),"%s unmounted ok, safe to remove",job->label);
+        show_message(GTK_MESSAGE_INFO, buf);
     }
 
-    return 0;
+    free_job(job);
 }
 
 /**
-Checks if a partition's disk or any of its parent devices are connected to any
-of a set of buses.  The device is identified by a sysfs path.  The bus array
-must be terminated with a NULL entry.
+Collects the output of a job without blocking.
 */
-int check_buses(char *devpath, char **buses)
+gboolean on_job_output(gint fd, GIOCondition condition, gpointer user_data)
 {
-    char fnbuf[256];
-    char *ptr;
-    int len;
+    MountJob *job = (MountJob *)user_data;
 
-    len = snprintf(fnbuf, sizeof(fnbuf), "/sys%s", devpath);
-    /* Default to no match if the path was too long. */
-    if(len+10>=(int)sizeof(fnbuf))
-        return 0;
+    if(!collect_child_output(&job->child))
+        return G_SOURCE_CONTINUE;
 
-    for(ptr=fnbuf+len; ptr>fnbuf+12; --ptr)
-        if(*ptr=='/')
-        {
-            char linkbuf[256];
-            /* Replace the last component with "subsystem". */
-            strcpy(ptr, "/subsystem");
-            len = readlink(fnbuf, linkbuf, sizeof(linkbuf)-1);
-
-            if(len!=-1)
-            {
-                linkbuf[len] = 0;
-                /* Extract the last component of the subsystem symlink. */
-                for(; (len>0 && linkbuf[len-1]!='/'); --len) ;
-
-                if(verbosity>=2)
-                {
-                    *ptr = 0;
-                    printf("  Subsystem of %s is %s\n", fnbuf, linkbuf+len);
-                }
-
-                if(is_in_array(buses, linkbuf+len))
-                    return 1;
-            }
-        }
+    finish_job(job);
 
-    return 0;
+    return G_SOURCE_REMOVE;
 }
 
 /**
-Check if an array of properties describes a device that can be mounted.  An
-array of explicitly allowed devices can be passed in as well.  Both arrays must
-be terminated by a NULL entry.
+Called when the pmount or pumount of a job exits.
 */
-int can_mount(Property *props, char **allowed)
+void on_job_exited(GPid pid, gint status, gpointer user_data)
 {
-    static char *removable_buses[] = { "usb", "firewire", 0 };
-    char *devname;
-    char *devpath;
-    char *bus;
-
-    devname = get_property_value(props, "DEVNAME");
-    if(is_in_array(allowed, devname))
-        return 1;
-
-    /* Special case for CD devices, since they are not partitions.  Only allow
-    mounting if media is inserted. */
-    if(match_property_value(props, "ID_TYPE", "cd") && match_property_value(props, "ID_CDROM_MEDIA", "1"))
-        return 1;
-
-    /* Only allow mounting partitions. */
-    if(!match_property_value(props, "DEVTYPE", "partition"))
-        return 0;
+    MountJob *job = (MountJob *)user_data;
 
-    devpath = get_property_value(props, "DEVPATH");
-    if(is_removable(devpath))
-        return 1;
-
-    /* Certain buses are removable by nature, but devices only advertise
-    themselves as removable if they support removable media, e.g. memory card
-    readers. */
-    bus = get_property_value(props, "ID_BUS");
-    if(is_in_array(removable_buses, bus))
-        return 1;
-
-    return check_buses(devpath, removable_buses);
+    g_spawn_close_pid(pid);
+    job->child.status = status;
+    job->child.exited = TRUE;
+    trace_span(T_MOUNT_COMMAND, job->started, job->node);
+    finish_job(job);
 }
 
 /**
-Returns an array of all device nodes in a directory.  Symbolic links are
-dereferenced.
+Stops the command of a job that has run past its deadline, in steps.  A
+command that even SIGKILL doesn't end is stuck in the kernel; the job waits
+for it, in case it ever comes back.
 */
-char **get_device_nodes(char *dirname)
+gboolean on_job_deadline(gpointer user_data)
 {
-    DIR *dir;
-    struct dirent *de;
-    char fnbuf[256];
-    char linkbuf[256];
-    struct stat st;
-    char **nodes = NULL;
-    int n_nodes = 0;
-    char **checked = NULL;
-    int n_checked = 0;
-    int i;
-
-    dir = opendir(dirname);
-    if(!dir)
-        return NULL;
+    MountJob *job = (MountJob *)user_data;
 
-    while((de = readdir(dir)))
+    check_child_deadline(&job->child);
+    if(job->child.stage==CHILD_ABANDONED)
     {
-        char *node;
-        int duplicate = 0;
-
-        /* Ignore . and .. entries. */
-        if(de->d_name[0]=='.' && (de->d_name[1]==0 || (de->d_name[1]=='.' && de->d_name[2]==0)))
-            continue;
-
-        snprintf(fnbuf, sizeof(fnbuf), "%s/%s", dirname, de->d_name);
-
-        node = fnbuf;
-        lstat(fnbuf, &st);
-        if(S_ISLNK(st.st_mode))
-        {
-            int len;
-            len = readlink(fnbuf, linkbuf, sizeof(linkbuf)-1);
-            if(len!=-1)
-            {
-                linkbuf[len] = 0;
-                node = linkbuf;
-            }
-        }
-
-        /* There may be multiple symlinks to the same device.  Only include each
-        device once in the returned array. */
-        if(checked)
-        {
-            for(i=0; (!duplicate && i<n_checked); ++i)
-                if(strcmp(node, checked[i])==0)
-                    duplicate = 1;
-        }
-        if(duplicate)
-        {
-            if(verbosity>=2)
-                printf("Device %s is a duplicate\n", fnbuf);
-            continue;
-        }
+        if(job->dev)
+            set_device_label(job->dev, "not responding");
+        job->deadline_timer = 0;
+        return G_SOURCE_REMOVE;
+    }
 
-        checked = (char **)realloc(checked, (n_checked+1)*sizeof(char *));
-        checked[n_checked] = strdup(node);
-        ++n_checked;
+    return G_SOURCE_CONTINUE;
+}
 
-        nodes = (char **)realloc(nodes, (n_nodes+2)*sizeof(char *));
-        nodes[n_nodes] = strdup(fnbuf);
-        ++n_nodes;
+/**
+Gives up on a job before its command could run, and restores the row.  The
+message is left out for a job the user cancelled.
+*/
+void abandon_job(MountJob *job, char *message)
+{
+    if(job->dev)
+    {
+        Device *dev = job->dev;
+        dev->job = NULL;
+        set_device_label(dev, NULL);
+        set_device_mount(dev, find_mount(mount_table, dev->devnum));
     }
+    if(message)
+        show_message(GTK_MESSAGE_ERROR, message);
+    free_job(job);
+}
 
-    closedir(dir);
-    if(checked)
+/**
+Runs the pmount or pumount of a job.
+*/
+void run_job_command(MountJob *job)
+{
+    Device target;
+
+    // the device may be gone by now, so use the job's copies
+    memset(&target, 0, sizeof(target));
+    target.node = job->node;
+    target.label = job->label;
+    target.shortdev = job->shortdev;
+    target.action = job->action;
+    target.uuid = job->uuid;
+    target.serial = job->serial;
+    target.fs_type = job->fs_type;
+
+    job->started = trace_now();
+    if(start_mount_command(&job->child, &target, job->mounting)<0)
     {
-        for(i=0; i<n_checked; ++i)
-            free(checked[i]);
-        free(checked);
+        abandon_job(job, (job->mounting ? "Could not start pmount" : "Could not start pumount"));
+        return;
     }
 
-    if(nodes)
-        nodes[n_nodes] = NULL;
+    g_unix_fd_add(job->child.fd, G_IO_IN|G_IO_HUP|G_IO_ERR, on_job_output, job);
+    g_child_watch_add(job->child.pid, on_job_exited, job);
+    if(job->child.deadline)
+        job->deadline_timer = g_timeout_add(250, on_job_deadline, job);
+
+    if(job->dev)
+        set_device_label(job->dev, (job->mounting ? "mounting..." : "unmounting..."));
+}
 
-    return nodes;
+/**
+Shows how the flush of a job is getting on: how much the device has written
+since it started, and how much data is still dirty or under writeback in the
+whole system, which is an upper bound for what is left.
+*/
+gboolean on_flush_progress(gpointer user_data)
+{
+    MountJob *job = (MountJob *)user_data;
+    WritebackStats stats;
+    char status[256];
+    int pos = 0;
+
+    if(!job->dev)
+        return G_SOURCE_CONTINUE;
+
+    read_writeback_stats(job->shortdev, &stats);
+    pos += snprintf(status+pos, sizeof(status)-pos, "flushing");
+    if(stats.sectors_written>=0 && job->start_sectors>=0)
+        pos += snprintf(status+pos, sizeof(status)-pos, ", %.1f MB written", (stats.sectors_written-job->start_sectors)/2048.0);
+    if(stats.dirty_kb>=0 && stats.writeback_kb>=0)
+        pos += snprintf(status+pos, sizeof(status)-pos, ", %.1f MB pending", (stats.dirty_kb+stats.writeback_kb)/1024.0);
+    if(stats.in_flight>0)
+        pos += snprintf(status+pos, sizeof(status)-pos, ", %lld request%s in flight", stats.in_flight, (stats.in_flight==1 ? "" : "s"));
+    set_device_label(job->dev, status);
+
+    return G_SOURCE_CONTINUE;
 }
 
-/** Returns an array of all mountable devices. */
-Device *get_devices(void)
+/**
+Called in the main loop when the flush of a job has finished.  The data is on
+the device now, so pumount won't have to wait for it.
+*/
+gboolean on_flush_done(gpointer user_data)
 {
-    char **nodes = NULL;
-    Device *devices = NULL;
-    int n_devices = 0;
-    char **mounted = NULL;
-    char **fstab = NULL;
-    int i;
+    MountJob *job = (MountJob *)user_data;
 
-    nodes = get_device_nodes("/dev/disk/by-id");
-    mounted = get_mounted_devices();
-    fstab = get_fstab_devices();
+    g_source_remove(job->progress_timer);
+    job->progress_timer = 0;
+    trace_span(T_FLUSH, job->started, job->node);
 
-    for(i=0; nodes[i]; ++i)
+    if(verbosity>=1)
     {
-        Property *props;
-
-        if(verbosity>=1)
-            printf("Examining device %s\n", nodes[i]);
+        if(job->flush_result<0)
+            printf("Could not flush %s, unmounting anyway\n", job->mountpoint);
+        else
+            printf("Flushed %s\n", job->mountpoint);
+    }
 
-        props = get_device_properties(nodes[i]);
-        if(!props)
-        {
-            if(verbosity>=2)
-                printf("  No properties\n");
-            continue;
-        }
+    if(job->cancelled)
+        abandon_job(job, NULL);
+    else
+        run_job_command(job);
 
-        if(verbosity>=2)
-        {
-            int j;
-            for(j=0; props[j].name; ++j)
-                printf("  %s = %s\n", props[j].name, props[j].value);
-        }
+    return G_SOURCE_REMOVE;
+}
 
+gpointer flush_thread(gpointer data)
+{
+    MountJob *job = (MountJob *)data;
 
-        if(can_mount(props, fstab))
-        {
-            char *devname;
-            char *label;
-            char *vendor;
-            char *model;
-            char buf[256];
-            char pos;
-            struct stat st;
-
-            if(verbosity>=1)
-                printf("  Using device\n");
-
-            devname = get_property_value(props, "DEVNAME");
-
-
-            /* Get a human-readable label for the device.  Use filesystem label,
-            filesystem UUID or device node name in order of preference. */
-            label = get_property_value(props, "ID_FS_LABEL");
-            if(!label)
-                label = get_property_value(props, "ID_FS_UUID");
-            if(!label)
-            {
-                char *ptr;
-
-                label = devname;
-                for(ptr=label; *ptr; ++ptr)
-                    if(*ptr=='/')
-                        label = ptr+1;
-            }
-
-            vendor = get_property_value(props, "ID_VENDOR");
-            model = get_property_value(props, "ID_MODEL");
-
-            pos = snprintf(buf, sizeof(buf), "%s", label);
-            if(vendor && model)
-                pos += snprintf(buf+pos, sizeof(buf)-pos, " (%s %s)", vendor, model);
-
-            stat(nodes[i], &st);
-
-            /* Reserve space for a sentinel entry. */
-            devices = (Device *)realloc(devices, (n_devices+2)*sizeof(Device));
-            devices[n_devices].node = nodes[i];
-            devices[n_devices].label = strdup(label);
-            devices[n_devices].description = strdup(buf);
-            devices[n_devices].mounted = is_in_array(mounted, devname);
-            devices[n_devices].time = st.st_mtime;
-            char* s = strrchr(devname,'/');
-            s++;
-            char* sd = strdup(s);
-            devices[n_devices].shortdev = sd;
-
-            ++n_devices;
-        }
-        else
-            free(nodes[i]);
-        free_properties(props);
-    }
+    job->flush_result = sync_mountpoint(job->mountpoint);
+    g_idle_add(on_flush_done, job);
 
-    free(nodes);
-    free_device_names(mounted);
+    return NULL;
+}
 
-    if(devices)
+/**
+Starts mounting or unmounting a device in the background.  The row shows the
+operation in progress until the command finishes.
+*/
+void start_mount_job(Device *dev, int mounting)
+{
+    MountJob *job;
+    WritebackStats stats;
+
+    job = (MountJob *)calloc(1, sizeof(MountJob));
+    ++n_jobs;
+    job->dev = dev;
+    job->mounting = mounting;
+    job->label = strdup(dev->label);
+    job->node = strdup(dev->node);
+    job->shortdev = strdup(dev->shortdev);
+    job->action = dev->action;
+    job->uuid = (dev->uuid ? strdup(dev->uuid) : NULL);
+    job->serial = (dev->serial ? strdup(dev->serial) : NULL);
+    job->fs_type = (dev->fs_type ? strdup(dev->fs_type) : NULL);
+    job->child.fd = -1;
+    dev->job = job;
+
+    if(mounting || !dev->mountpoint)
     {
-        devices[n_devices].node = NULL;
-        devices[n_devices].label = NULL;
-        devices[n_devices].description = NULL;
-        devices[n_devices].shortdev = NULL;
+        run_job_command(job);
+        return;
     }
 
-    return devices;
+    read_writeback_stats(job->shortdev, &stats);
+    job->start_sectors = stats.sectors_written;
+    job->mountpoint = strdup(dev->mountpoint);
+    job->started = trace_now();
+    set_device_label(dev, "flushing...");
+    job->progress_timer = g_timeout_add(250, on_flush_progress, job);
+    g_thread_unref(g_thread_new("flush", flush_thread, job));
 }
 
 /**
-Frees an array of devices and all strings contained in it.
+Forgets a device's job before the device is freed.  The job carries on and
+reports its result without touching the row.
 */
-void free_devices(Device *devices)
+void detach_job(Device *dev)
 {
-    int i;
-    if(!devices)
-        return;
-    for(i=0; devices[i].node; ++i)
-    {
-        free(devices[i].node);
-        free(devices[i].label);
-        free(devices[i].description);
-        free(devices[i].shortdev);
-    }
-    free(devices);
-}
-
-GtkWidget* list; // listbox holding the check buttons
-int enable_callbacks=FALSE; // disable the tick callback
-
-// callback called when a check button is altered
-void toggled(GtkToggleButton *button, gpointer user_data) {
-    if (!enable_callbacks) return;
-    Device* dev = (Device*)user_data;
-    int pid;
-    int pipe_fd[2];
-
-    //printf("node=%s\n",dev->node);
-
-    /* creates a pipe
-     * pipe_fd[0] for reading
-     * pipe_fd[1] for writing */
-    pipe(pipe_fd);
-    /* create a new process
-     * pid is set to 0 in the child process
-     * and to the child pid in the parent process */
-    pid = fork();
-    // 0 is "forker"
-
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(dev->toggle))) {
-        hasMounted=TRUE;
-    } else {
-        hasMounted=FALSE;
-    } // must set flag before fork changes execution path...
-
-    // only executed in child process
-    if(pid==0)
-    {
-        close(pipe_fd[0]);
+    if(dev->job)
+        dev->job->dev = NULL;
+    dev->job = NULL;
+}
+
+/**
+Stops a job: its command if it is running, or the command that would follow
+the flush otherwise.
+*/
+void cancel_job(MountJob *job)
+{
+    job->cancelled = TRUE;
+    if(job->child.pid)
+        stop_child(&job->child);
+    if(job->dev)
+        set_device_label(job->dev, "cancelling...");
+}
 
-        char mountingpoint[1024];
-        snprintf(mountingpoint,1024,"%s-%s",dev->shortdev,dev->label);
+void on_cancel_response(GtkDialog *dialog, gint response, gpointer user_data)
+{
+    MountJob *job = (MountJob *)user_data;
 
-        if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(dev->toggle))) {
-            //printf("mounting device /dev/%s on /media/%s\n", dev->shortdev,mountingpoint);
-            execl("/usr/bin/pmount", "pmount", dev->node, mountingpoint, NULL);
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+    job->cancel_dialog = NULL;
+    if(response==GTK_RESPONSE_YES && !job->cancelled)
+        cancel_job(job);
+}
 
-        } else {
-            //printf("unmounting device /dev/%s from /media/%s\n",dev->shortdev,mountingpoint);
-            execl("/usr/bin/pumount", "pumount", dev->node, NULL);
+// asks whether to cancel a job whose row was clicked
+void ask_cancel_job(MountJob *job) {
+    if (job->cancel_dialog || job->cancelled) return;
+    job->cancel_dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO,
+        "Cancel %s %s?", (job->mounting ? "mounting" : "unmounting"), job->label);
+    g_signal_connect(job->cancel_dialog, "response", G_CALLBACK(on_cancel_response), job);
+    gtk_widget_show_all(job->cancel_dialog);
+}
 
-            //printf("deleting folder /media/%s",mountingpoint);
-            rmdir( strcat( "/media/", mountingpoint ) );
-        }
-        _exit(1);
-    } // if we were forked then pickup all the colsole output
-    else if(pid>0) {
-        char buf[1024];
-        int pos = 0;
-        int status = 0;
-        fd_set fds;
-        struct timeval timeout;
-
-        close(pipe_fd[1]);
-        FD_ZERO(&fds);
-        FD_SET(pipe_fd[0], &fds);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 200000;
-
-        while(1)
-        {
-            if(select(pipe_fd[0]+1, &fds, NULL, NULL, &timeout))
-            {
-                int len;
-
-                len = read(pipe_fd[0], buf+pos, sizeof(buf)-pos-1);
-                if(len<=0)
-                    break;
-                pos += len;
-            }
-            else if(waitpid(pid, &status, 0))
-            {
-                pid = 0;
-                break;
-            }
-        }
+// mounts or unmounts a device whose row was clicked, or offers to cancel what
+// is being done to it
+void toggle_device(Device* dev) {
+    if (dev->job)
+        ask_cancel_job(dev->job);
+    else
+        start_mount_job(dev, !dev->mounted);
+}
 
-        if(pid) // ensure its actually finished
-            waitpid(pid, &status, 0);
+// the device in a row of the view
+Device* get_path_device(GtkTreePath* path) {
+    GtkTreeIter iter;
+    Device *dev = NULL;
 
-        buf[pos] = 0;
+    if (gtk_tree_model_get_iter(device_filter, &iter, path))
+        gtk_tree_model_get(device_filter, &iter, COL_DEVICE, &dev, -1);
+    return dev;
+}
 
-        if(verbosity>=1)
-        {
-            if(WIFEXITED(status))
-            {
-                if(WEXITSTATUS(status))
-                    printf("Command exited successfully\n");
-                else
-                    printf("Command exited with status %d\n", WEXITSTATUS(status));
-            }
-            else if(WIFSIGNALED(status))
-                printf("Command terminated with signal %d\n", WTERMSIG(status));
-            else
-                printf("Command exited with unknown result %04X\n", status);
-        }
+// called when the tick of a row is clicked
+void on_device_toggled(GtkCellRendererToggle *cell, gchar *path_str, gpointer user_data) {
+    GtkTreePath *path = gtk_tree_path_new_from_string(path_str);
+    Device *dev = get_path_device(path);
 
-        if (filemanager[0]!=0) {
-            if (hasMounted) {
-                char mp[1024];
-                snprintf(mp,1024,"/media/%s-%s",dev->label,dev->shortdev);
-                chdir(mp);
-                execl(filemanager,filemanager,(char*)0);
-            }
-        }
+    gtk_tree_path_free(path);
+    if (dev)
+        toggle_device(dev);
+}
 
+// called for a double click or Enter on a row
+void on_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *column, gpointer user_data) {
+    Device *dev = get_path_device(path);
 
-        // give error message or alternativly confirm that mount or unmount
-        // did actually happen...
-        GtkWidget *dialog;
-        if(!WIFEXITED(status) || WEXITSTATUS(status))
-        {
-            dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, "%s", buf);
-            g_signal_connect(dialog, "response", &gtk_main_quit, NULL);
-            gtk_widget_show_all(dialog);
-        }
-        else {
-            if (okfeedback==TRUE) {
-                if (hasMounted) {
-                    snprintf(buf,1023,"%s mounted ok %s",dev->label,dev->node);
-                    //printf("mounting device node=%s label=%s desc=%s\n",dev->node,dev->label,dev->description);
+    if (dev)
+        toggle_device(dev);
+}
+
+// ticks the rows of mounted devices; while a job runs, the tick shows what the
+// job will make of the device
+void render_device_toggle(GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data) {
+    Device *dev;
 
-                } else {
-                    snprintf(buf,1023,"%s unmounted ok",dev->label);
-                }
-                dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL, GTK_MESSAGE_INFO, GTK_BUTTONS_OK, "%s", buf);
-                g_signal_connect(dialog, "response", &gtk_main_quit, NULL);
-                gtk_widget_show_all(dialog);
+    gtk_tree_model_get(model, iter, COL_DEVICE, &dev, -1);
+    g_object_set(cell, "active", (dev->job ? dev->job->mounting : dev->mounted), NULL);
+}
+
+// formats the text of a row as it is drawn: the device's label and name, and
+// its status if there is one or else the space on its filesystem
+void render_device_text(GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data) {
+    Device *dev;
+    char *status;
+    char mp[1024];
+    char space[128];
+
+    gtk_tree_model_get(model, iter, COL_DEVICE, &dev, COL_STATUS, &status, -1);
+    format_device_space(dev, space, sizeof(space));
+    if (status)
+        snprintf(mp,1024,"%s | %s (%s)",dev->label,dev->shortdev,status);
+    else if (space[0])
+        snprintf(mp,1024,"%s | %s | %s",dev->label,dev->shortdev,space);
+    else
+        snprintf(mp,1024,"%s | %s",dev->label,dev->shortdev);
+    g_object_set(cell, "text", mp, NULL);
+    g_free(status);
+}
 
+// shows the description of the device under the pointer
+gboolean on_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard, GtkTooltip *tooltip, gpointer user_data) {
+    GtkTreeModel *model;
+    GtkTreePath *path;
+    GtkTreeIter iter;
+    MountProfile *profile;
+    char options[256];
+    char buf[1100];
+    Device *dev;
+
+    if (!gtk_tree_view_get_tooltip_context(GTK_TREE_VIEW(widget), &x, &y, keyboard, &model, &path, &iter))
+        return FALSE;
+    gtk_tree_model_get(model, &iter, COL_DEVICE, &dev, -1);
+    profile = match_profile(mount_profiles, dev->uuid, dev->serial, dev->fs_type);
+    if (profile) {
+        describe_profile(profile, options, sizeof(options));
+        snprintf(buf,sizeof(buf),"%s\nMount options for %s: %s",dev->description,profile->key,options);
+    } else
+        snprintf(buf,sizeof(buf),"%s\nMount options: pmount defaults",dev->description);
+    gtk_tooltip_set_text(tooltip, buf);
+    gtk_tree_view_set_tooltip_row(GTK_TREE_VIEW(widget), tooltip, path);
+    gtk_tree_path_free(path);
+    return TRUE;
+}
 
+/* The mount options dialog of a device.  It edits the profile of one key at a
+time, chosen from the keys the device has, and keeps copies of them so the
+device may go away while the dialog is open. */
+typedef struct sProfileEditor
+{
+    GtkWidget *dialog;
+    GtkWidget *scope; // which key the profile is for
+    GtkWidget *sync;
+    GtkWidget *noatime;
+    GtkWidget *read_only;
+    GtkWidget *umask;
+    GtkWidget *charset;
+    char *keys[3]; // uuid=, serial= and fstype=, NULL where missing
+} ProfileEditor;
+
+// the key whose profile the editor shows
+char* get_editor_key(ProfileEditor *editor) {
+    const gchar *id = gtk_combo_box_get_active_id(GTK_COMBO_BOX(editor->scope));
+    return (id ? editor->keys[atoi(id)] : NULL);
+}
 
+// fills in the editor from the profile of the chosen key
+void show_editor_profile(ProfileEditor *editor) {
+    MountProfile *profile = find_profile(mount_profiles, get_editor_key(editor));
+    MountProfile defaults;
 
-            } else {
-                gtk_main_quit();
-            }
-        }
+    if (!profile) {
+        memset(&defaults, 0, sizeof(defaults));
+        profile = &defaults;
     }
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(editor->sync), profile->sync);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(editor->noatime), profile->noatime);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(editor->read_only), profile->read_only);
+    gtk_entry_set_text(GTK_ENTRY(editor->umask), (profile->umask ? profile->umask : ""));
+    gtk_entry_set_text(GTK_ENTRY(editor->charset), (profile->charset ? profile->charset : ""));
+}
 
+void on_editor_scope_changed(GtkComboBox *combo, gpointer user_data) {
+    show_editor_profile((ProfileEditor *)user_data);
+}
 
+// stores the profile shown in the editor; returns FALSE if an entry isn't valid
+gboolean store_editor_profile(ProfileEditor *editor) {
+    MountProfile profile;
+    char option[64];
+    char *key = get_editor_key(editor);
+    MountProfile *stored;
+    int valid = TRUE;
+
+    memset(&profile, 0, sizeof(profile));
+    profile.sync = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(editor->sync));
+    profile.noatime = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(editor->noatime));
+    profile.read_only = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(editor->read_only));
+    if (gtk_entry_get_text(GTK_ENTRY(editor->umask))[0]) {
+        snprintf(option,sizeof(option),"umask=%s",gtk_entry_get_text(GTK_ENTRY(editor->umask)));
+        valid = (parse_profile_option(&profile, option)==0);
+    }
+    if (valid && gtk_entry_get_text(GTK_ENTRY(editor->charset))[0]) {
+        snprintf(option,sizeof(option),"charset=%s",gtk_entry_get_text(GTK_ENTRY(editor->charset)));
+        valid = (parse_profile_option(&profile, option)==0);
+    }
+    if (!valid) {
+        free(profile.umask);
+        free(profile.charset);
+        show_message(GTK_MESSAGE_ERROR, "The umask must be 3 or 4 octal digits, and the charset a name like utf8 or iso8859-1");
+        return FALSE;
+    }
 
+    remove_profile(mount_profiles, key);
+    stored = set_profile(mount_profiles, key);
+    profile.key = stored->key;
+    *stored = profile;
+    return TRUE;
 }
 
-// adds a check button to the list for a device
-void addDevice(Device* dev) {
-    char mp[1024];
-    snprintf(mp,1024,"%s | %s",dev->label,dev->shortdev);
-    // create a check button for the device
-    dev->toggle=gtk_check_button_new_with_label ((gchar*)strdup(mp)); // TODO potential leak??  (cleaned by app exit anyhow)
-    // set tooltip for check button
-    gtk_widget_set_tooltip_text(dev->toggle, dev->description);
+void free_profile_editor(ProfileEditor *editor) {
+    int i;
 
-    g_signal_connect (dev->toggle, "toggled", G_CALLBACK (toggled), dev);
-    gtk_widget_show(dev->toggle);
-    gtk_container_add(GTK_CONTAINER(list), dev->toggle);
+    for (i=0; i<3; ++i)
+        free(editor->keys[i]);
+    free(editor);
 }
 
-// updates the list of devices
-void update_device_list() {
-    int i;
+void on_editor_response(GtkDialog *dialog, gint response, gpointer user_data) {
+    ProfileEditor *editor = (ProfileEditor *)user_data;
 
-    // delete widgets
-    if(devices){
-        for(i=0; devices[i].node; ++i) {
-            printf("hiding %s\n",devices[i].shortdev);
-            gtk_widget_destroy(devices[i].toggle);
-            //gtk_container_remove(GTK_LIST(list),devices[i].toggle);
-        }
+    if (response==GTK_RESPONSE_OK && !store_editor_profile(editor))
+        return;
+    if (response==GTK_RESPONSE_REJECT)
+        remove_profile(mount_profiles, get_editor_key(editor));
+    if ((response==GTK_RESPONSE_OK || response==GTK_RESPONSE_REJECT) && profiles_file[0]
+        && save_profiles(mount_profiles, profiles_file)<0) {
+        char buf[1100];
+        snprintf(buf,sizeof(buf),"Could not save %s",profiles_file);
+        show_message(GTK_MESSAGE_ERROR, buf);
     }
 
-    devices = get_devices();
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+    free_profile_editor(editor);
+}
 
-    // show devices
-    if (devices) {
-        for(i=0; devices[i].node; ++i) {
-            printf("adding %s\n",devices[i].shortdev);
-            addDevice(&devices[i]);
-            if(devices[i].mounted) {
-                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(devices[i].toggle),TRUE);
-            }
+// opens the mount options of a device, starting with the profile it uses
+void edit_device_profile(Device* dev) {
+    static char *kinds[] = { "uuid", "serial", "fstype" };
+    char *values[] = { dev->uuid, dev->serial, dev->fs_type };
+    MountProfile *current = match_profile(mount_profiles, dev->uuid, dev->serial, dev->fs_type);
+    ProfileEditor *editor = (ProfileEditor *)calloc(1, sizeof(ProfileEditor));
+    GtkWidget *grid = gtk_grid_new();
+    char buf[1100];
+    int active = -1;
+    int i;
 
-        }
+    snprintf(buf,sizeof(buf),"Mount options of %s",dev->label);
+    editor->dialog = gtk_dialog_new_with_buttons(buf, GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT,
+        "Use defaults", GTK_RESPONSE_REJECT, "Cancel", GTK_RESPONSE_CANCEL, "Save", GTK_RESPONSE_OK, NULL);
+    gtk_dialog_set_default_response(GTK_DIALOG(editor->dialog), GTK_RESPONSE_OK);
+
+    editor->scope = gtk_combo_box_text_new();
+    for (i=0; i<3; ++i) {
+        char id[4];
+        if (!values[i] || !values[i][0])
+            continue;
+        snprintf(buf,sizeof(buf),"%s=%s",kinds[i],values[i]);
+        editor->keys[i] = strdup(buf);
+        if (i==0)
+            snprintf(buf,sizeof(buf),"This filesystem (%s)",values[i]);
+        else if (i==1)
+            snprintf(buf,sizeof(buf),"This drive (%s)",values[i]);
+        else
+            snprintf(buf,sizeof(buf),"All %s filesystems",values[i]);
+        snprintf(id,sizeof(id),"%d",i);
+        gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(editor->scope), id, buf);
+        if (active<0 || (current && !strcmp(current->key, editor->keys[i])))
+            active = i;
+    }
+    if (active<0) {
+        show_message(GTK_MESSAGE_ERROR, "udev reports no filesystem UUID, serial number or filesystem type for this device");
+        gtk_widget_destroy(editor->dialog);
+        free_profile_editor(editor);
+        return;
     }
+
+    editor->sync = gtk_check_button_new_with_label("Write through (sync), slower but safer to pull out");
+    editor->noatime = gtk_check_button_new_with_label("Don't record access times (noatime)");
+    editor->read_only = gtk_check_button_new_with_label("Read-only");
+    editor->umask = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(editor->umask), "pmount's default, e.g. 077");
+    editor->charset = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(editor->charset), "pmount's default, e.g. utf8");
+
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 8);
+    gtk_container_set_border_width(GTK_CONTAINER(grid), 8);
+    gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Apply to"), 0, 0, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->scope, 1, 0, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->sync, 0, 1, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->noatime, 0, 2, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->read_only, 0, 3, 2, 1);
+    gtk_grid_attach(GTK_GRID(grid), gtk_label_new("umask"), 0, 4, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->umask, 1, 4, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), gtk_label_new("File name charset"), 0, 5, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), editor->charset, 1, 5, 1, 1);
+    gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(editor->dialog))), grid);
+
+    snprintf(buf,sizeof(buf),"%d",active);
+    gtk_combo_box_set_active_id(GTK_COMBO_BOX(editor->scope), buf);
+    show_editor_profile(editor);
+    g_signal_connect(editor->scope, "changed", G_CALLBACK(on_editor_scope_changed), editor);
+    g_signal_connect(editor->dialog, "response", G_CALLBACK(on_editor_response), editor);
+    gtk_widget_show_all(editor->dialog);
 }
 
-gboolean checkDevices(gpointer user_data) {
-    if (!devices) {
-        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
-                            "Sorry couldn't find any appropriate devices");
-        g_signal_connect(dialog, "response", &gtk_main_quit, NULL);
-        gtk_widget_show_all(dialog);
+// right-clicking a row opens its mount options
+gboolean on_view_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data) {
+    GtkTreePath *path;
+    Device *dev;
+
+    if (event->type!=GDK_BUTTON_PRESS || event->button!=3)
+        return FALSE;
+    if (!gtk_tree_view_get_path_at_pos(GTK_TREE_VIEW(widget), event->x, event->y, &path, NULL, NULL, NULL))
+        return FALSE;
+    dev = get_path_device(path);
+    gtk_tree_path_free(path);
+    if (dev)
+        edit_device_profile(dev);
+    return TRUE;
+}
+
+// the menu key or shift-F10 does the same for the selected row
+gboolean on_view_popup_menu(GtkWidget *widget, gpointer user_data) {
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+    Device *dev;
+
+    if (!gtk_tree_selection_get_selected(gtk_tree_view_get_selection(GTK_TREE_VIEW(widget)), &model, &iter))
+        return FALSE;
+    gtk_tree_model_get(model, &iter, COL_DEVICE, &dev, -1);
+    edit_device_profile(dev);
+    return TRUE;
+}
+
+// whether text contains the filter text, ignoring case
+int match_filter(char* text) {
+    int i;
 
+    if (!text)
+        return FALSE;
+    for (; *text; ++text) {
+        for (i=0; filter_text[i] && tolower((unsigned char)text[i])==filter_text[i]; ++i) ;
+        if (!filter_text[i])
+            return TRUE;
     }
     return FALSE;
 }
 
+// shows the rows whose label, name, vendor or model contain the filter text;
+// the description holds the label, vendor and model
+gboolean is_device_visible(GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data) {
+    Device *dev;
 
-int main(int argc, char** argv)
-{
-    filemanager[0]=0;
-    int opt;
-    while((opt = getopt(argc, argv, "vhkf:"))!=-1) switch(opt)
-        {
-        case 'v':
-            ++verbosity;
-            break;
-        case 'k':
-            okfeedback=TRUE;
-            break;
-        case 'f':
-            snprintf(filemanager,1024,"%s",optarg);
-            break;
-        case 'h':
-            printf("-v verbosity  -k extra feedback  -h help! \n");
-            printf("-f filemanager (supply full path of application to\n");
-            printf("use to view newly mounted media\n");
-            return 0;
+    if (!filter_text[0])
+        return TRUE;
+    gtk_tree_model_get(model, iter, COL_DEVICE, &dev, -1);
+    return dev && (match_filter(dev->description) || match_filter(dev->shortdev));
+}
+
+// applies the filter box as it is typed into
+void on_filter_changed(GtkSearchEntry *entry, gpointer user_data) {
+    const char *text = gtk_entry_get_text(GTK_ENTRY(entry));
+    int i;
+
+    for (i=0; text[i] && i<(int)sizeof(filter_text)-1; ++i)
+        filter_text[i] = tolower((unsigned char)text[i]);
+    filter_text[i] = 0;
+    gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(device_filter));
+}
+
+void on_filter_stopped(GtkSearchEntry *entry, gpointer user_data) {
+    gtk_entry_set_text(GTK_ENTRY(entry), "");
+}
+
+// typing anywhere in the window goes to the filter box, except that space
+// still ticks the selected row while there is no filter
+gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+    if (gtk_widget_has_focus(filter_entry))
+        return FALSE;
+    if (event->keyval==GDK_KEY_space && !filter_text[0])
+        return FALSE;
+    return gtk_search_entry_handle_event(GTK_SEARCH_ENTRY(filter_entry), (GdkEvent *)event);
+}
+
+// adds a row to the list for a device
+void addDevice(Device* dev) {
+    double start = trace_now();
+    GtkTreeIter iter;
+
+    // list store iters stay valid until their row is removed
+    gtk_list_store_insert_with_values(device_store, &iter, -1, COL_DEVICE, dev, -1);
+    dev->row = malloc(sizeof(GtkTreeIter));
+    *(GtkTreeIter *)dev->row = iter;
+    query_device_space(dev);
+    trace_span(T_WIDGETS, start, dev->shortdev);
+}
+
+/* What is known about a /dev/disk/by-id node: where it pointed and the mtime of
+the device node when it was last examined, and its device if it turned out to
+be mountable.  Nodes that have not changed since are not examined again. */
+typedef struct sNodeState
+{
+    char *node; // its key in node_states
+    char *target; // e.g. "/dev/sdb1"
+    time_t time;
+    Device *dev;
+    int generation;
+    int examining; // waiting for the scan thread
+    int arrived; // appeared after the first scan, so its rule applies
+} NodeState;
+
+GHashTable *node_states = NULL; // by-id path -> NodeState
+GHashTable *nodes_by_target = NULL; // target -> NodeState, for device events
+int list_generation = 0;
+
+// the node is freed as the key of node_states
+void free_node_state(gpointer data) {
+    NodeState *ns = (NodeState *)data;
+    free(ns->target);
+    free(ns);
+}
+
+void init_node_states() {
+    if (node_states)
+        return;
+    node_states = g_hash_table_new_full(g_str_hash, g_str_equal, free, free_node_state);
+    nodes_by_target = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+// writes the /dev name a node stands for to buf: where it points for a link,
+// or the node's own name under /dev otherwise
+void get_node_target(char *node, char *buf, int size) {
+    char *name;
+
+    if (get_link_devname(node, buf, size)==0)
+        return;
+    name = strrchr(node, '/');
+    snprintf(buf, size, "/dev/%s", (name ? name+1 : node));
+}
+
+// forgets the target of a node state, unless another node has taken it over
+void unindex_node_state(NodeState *ns) {
+    if (g_hash_table_lookup(nodes_by_target, ns->target)==ns)
+        g_hash_table_remove(nodes_by_target, ns->target);
+}
+
+// records the state of a node, replacing the one it had; node becomes the key
+// and is freed with it
+void put_node_state(char *node, NodeState *ns) {
+    NodeState *old = (NodeState *)g_hash_table_lookup(node_states, node);
+
+    if (old)
+        unindex_node_state(old);
+    ns->node = node;
+    g_hash_table_replace(node_states, node, ns);
+    g_hash_table_replace(nodes_by_target, ns->target, ns);
+}
+
+// adds a device to the end of devices, which grows geometrically since a
+// scan can add thousands of them one by one
+void appendDevice(Device* dev) {
+    if (n_devices+2>n_devices_alloc) {
+        n_devices_alloc = (n_devices_alloc ? n_devices_alloc*2 : 16);
+        devices = (Device **)realloc(devices, n_devices_alloc*sizeof(Device *));
+    }
+    devices[n_devices++] = dev;
+    devices[n_devices] = NULL;
+}
+
+// removes a device's row and frees the device
+void removeDevice(Device* dev) {
+    int i;
+
+    if (verbosity>=1)
+        printf("removing %s\n",dev->shortdev);
+
+    for (i=0; devices[i]!=dev; ++i) ;
+    for (; devices[i]; ++i)
+        devices[i]=devices[i+1];
+    --n_devices;
+
+    detach_job(dev);
+    gtk_list_store_remove(device_store, (GtkTreeIter *)dev->row);
+    free(dev->row);
+    free_device(dev);
+}
+
+// drops a node that has gone away, along with its row
+void remove_node_state(NodeState *ns) {
+    if (ns->dev)
+        removeDevice(ns->dev);
+    unindex_node_state(ns);
+    g_hash_table_remove(node_states, ns->node);
+}
+
+/**
+Marks every node as changed, so that the next update examines them again.
+*/
+void invalidate_nodes(void)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if(!node_states)
+        return;
+
+    g_hash_table_iter_init(&iter, node_states);
+    while(g_hash_table_iter_next(&iter, NULL, &value))
+        ((NodeState *)value)->time = (time_t)-1;
+}
+
+/* An enumeration running in a worker thread.  It works on copies of the nodes
+to examine and of the fstab devices, so the main loop is free to change its own
+state meanwhile.  Each mountable device is passed back to the main loop as soon
+as it is found, followed by a result without a device when the scan is over. */
+typedef struct sScan
+{
+    char **nodes;
+    FstabSet *allowed;
+} Scan;
+
+typedef struct sScanResult
+{
+    Scan *scan;
+    Device *dev;
+} ScanResult;
+
+int dry_run = FALSE; // print what the automount rules would do instead
+
+// mounts a device that has just been plugged in if its rule says so
+void apply_rule(Device* dev) {
+    if (dev->action!=ACTION_AUTOMOUNT && dev->action!=ACTION_READ_ONLY)
+        return;
+    if (dev->mounted || dev->job)
+        return;
+    if (verbosity>=1)
+        printf("%s: rule on line %d, %s\n", dev->shortdev, dev->rule, rule_action_name(dev->action));
+    start_mount_job(dev, TRUE);
+}
+
+int scanning = FALSE; // a scan thread is running
+int rescan_pending = FALSE; // the list was updated during a scan
+int first_scan_done = FALSE;
+GtkWidget* scanning_label; // placeholder shown while scanning
+
+gboolean checkDevices(gpointer user_data);
+void update_device_list();
+
+// called in the main loop when a scan is over
+void scan_finished(Scan* scan) {
+    int i;
+
+    if (scan) {
+        for (i=0; scan->nodes[i]; ++i) {
+            NodeState *ns = (NodeState *)g_hash_table_lookup(node_states, scan->nodes[i]);
+            if (ns)
+                ns->examining = FALSE;
+        }
+        free_device_names(scan->nodes);
+        unref_fstab_set(scan->allowed);
+        free(scan);
+    }
+
+    scanning = FALSE;
+    gtk_widget_hide(scanning_label);
+
+    // only complain about missing devices once they have been looked for,
+    // and after gtk has realised the window
+    if (!first_scan_done) {
+        first_scan_done = TRUE;
+        g_idle_add(checkDevices, NULL);
+    }
+    if (rescan_pending) {
+        rescan_pending = FALSE;
+        update_device_list();
+    }
+}
+
+// called in the main loop for each message from the scan thread
+gboolean on_scan_result(gpointer user_data) {
+    ScanResult *result = (ScanResult *)user_data;
+    Device *dev = result->dev;
+    NodeState *ns;
+    MountEntry *me;
+
+    if (!dev) {
+        scan_finished(result->scan);
+        free(result);
+        return FALSE;
+    }
+    free(result);
+
+    ns = (NodeState *)g_hash_table_lookup(node_states, dev->node);
+    if (!ns) {
+        free_device(dev);
+        return FALSE;
+    }
+    ns->dev = dev;
+
+    me = (dev->devnum ? find_mount(mount_table, dev->devnum) : NULL);
+    dev->mounted = (me!=NULL);
+    dev->mountpoint = (me ? strdup(me->mountpoint) : NULL);
+
+    if (verbosity>=1)
+        printf("adding %s\n",dev->shortdev);
+    appendDevice(dev);
+    addDevice(dev);
+
+    if (dry_run) {
+        if (dev->rule)
+            printf("%s %s: line %d, %s\n", dev->shortdev, dev->label, dev->rule, rule_action_name(dev->action));
+        else
+            printf("%s %s: no rule\n", dev->shortdev, dev->label);
+    }
+    else if (ns->arrived)
+        apply_rule(dev);
+
+    return FALSE;
+}
+
+// passes a device, or the end of the scan, from the scan thread to the main loop
+void post_scan_result(Device *dev, void *data) {
+    ScanResult *result = (ScanResult *)calloc(1, sizeof(ScanResult));
+    result->scan = (Scan *)data;
+    result->dev = dev;
+    // same priority for all messages, so they arrive in order
+    g_idle_add_full(G_PRIORITY_DEFAULT, on_scan_result, result, NULL);
+}
+
+gpointer scan_thread(gpointer data) {
+    Scan *scan = (Scan *)data;
+
+    examine_nodes_with(scan->nodes, scan->allowed, post_scan_result, scan);
+    post_scan_result(NULL, scan);
+
+    return NULL;
+}
+
+char **queued_nodes = NULL; // waiting for the next scan, NULL terminated
+int n_queued = 0;
+int n_queued_alloc = 0;
+
+// starts over with a node that is new or has changed: its row is dropped and
+// it is queued to be examined by the next scan
+void queue_node(char *node, char *target, time_t time, int arrived) {
+    NodeState *old = (NodeState *)g_hash_table_lookup(node_states, node);
+    NodeState *ns;
+
+    if (old && old->dev)
+        removeDevice(old->dev);
+
+    ns = (NodeState *)calloc(1, sizeof(NodeState));
+    ns->arrived = arrived;
+    ns->target = strdup(target);
+    ns->time = time;
+    ns->generation = list_generation;
+    ns->examining = TRUE;
+    put_node_state(strdup(node), ns);
+
+    if (n_queued+2>n_queued_alloc) {
+        n_queued_alloc = (n_queued_alloc ? n_queued_alloc*2 : 16);
+        queued_nodes = (char **)realloc(queued_nodes, n_queued_alloc*sizeof(char *));
+    }
+    queued_nodes[n_queued++] = strdup(node);
+    queued_nodes[n_queued] = NULL;
+}
+
+// examines the queued nodes in the background and shows the mountable ones;
+// returns FALSE if there were none
+int start_scan() {
+    Scan *scan;
+
+    if (verbosity>=1)
+        printf("%d of %d nodes changed\n", n_queued, g_hash_table_size(node_states));
+    if (!queued_nodes)
+        return FALSE;
+
+    scan = (Scan *)calloc(1, sizeof(Scan));
+    scan->nodes = queued_nodes;
+    scan->allowed = ref_fstab_set(fstab_set);
+    queued_nodes = NULL;
+    n_queued = 0;
+    n_queued_alloc = 0;
+    scanning = TRUE;
+    gtk_widget_show(scanning_label);
+    g_thread_unref(g_thread_new("scan", scan_thread, scan));
+
+    return TRUE;
+}
+
+// updates the list of devices; new and changed nodes are examined in the
+// background and their rows appear as they are found
+void update_device_list() {
+    GHashTableIter iter;
+    gpointer value;
+    char **nodes;
+    int i;
+
+    if (scanning) {
+        rescan_pending = TRUE;
+        return;
+    }
+
+    init_node_states();
+    ++list_generation;
+
+    load_mount_state();
+    nodes = list_device_nodes();
+
+    // keep rows of nodes that still point to the same device node
+    for (i=0; nodes && nodes[i]; ++i) {
+        NodeState *ns = (NodeState *)g_hash_table_lookup(node_states, nodes[i]);
+        char target[1024];
+        struct stat st;
+
+        get_node_target(nodes[i], target, sizeof(target));
+        if (stat(nodes[i], &st)<0)
+            st.st_mtime = 0;
+
+        if (ns && !strcmp(ns->target, target) && ns->time==st.st_mtime) {
+            ns->generation = list_generation;
+            // mount state is kept up to date by the watcher if there is one
+            if (ns->dev && !mounts_watched)
+                set_device_mount(ns->dev, find_mount(mount_table, ns->dev->devnum));
+            continue;
+        }
+
+        // a node that changed, e.g. when it was unmounted, hasn't arrived
+        queue_node(nodes[i], target, st.st_mtime, (!ns && first_scan_done));
+    }
+    free_device_names(nodes);
+
+    // drop nodes that have gone away
+    g_hash_table_iter_init(&iter, node_states);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        NodeState *ns = (NodeState *)value;
+        if (ns->generation!=list_generation) {
+            if (ns->dev)
+                removeDevice(ns->dev);
+            unindex_node_state(ns);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    if (!start_scan())
+        scan_finished(NULL);
+}
+
+char cache_file[1024]; // empty if the device cache is not used
+
+// shows the devices from the cache, before the real list has been built;
+// returns FALSE if there was no usable cache
+int load_cached_device_list() {
+    CachedNode *cached;
+    int n_cached;
+    int i;
+
+    if (!cache_file[0])
+        return FALSE;
+    cached = load_device_cache(cache_file, &n_cached);
+    if (!cached)
+        return FALSE;
+
+    init_node_states();
+    load_mount_state();
+
+    for (i=0; i<n_cached; ++i) {
+        NodeState *ns = (NodeState *)calloc(1, sizeof(NodeState));
+        Device *dev = cached[i].dev;
+
+        ns->target = cached[i].target;
+        ns->time = cached[i].time;
+        ns->dev = dev;
+        ns->generation = list_generation;
+        put_node_state(cached[i].node, ns);
+
+        if (dev) {
+            MountEntry *me = find_mount(mount_table, dev->devnum);
+            dev->mounted = (me!=NULL);
+            dev->mountpoint = (me ? strdup(me->mountpoint) : NULL);
+            appendDevice(dev);
+            addDevice(dev);
+        }
+    }
+    // the strings and devices now belong to the node states
+    free(cached);
+
+    return TRUE;
+}
+
+// checks the rows taken from the cache against the system
+gboolean revalidate_device_list(gpointer user_data) {
+    update_device_list();
+    return FALSE;
+}
+
+// remembers the examined nodes for the next start
+void save_cached_device_list() {
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    CachedNode *nodes;
+    int n_nodes = 0;
+
+    if (!cache_file[0] || !node_states)
+        return;
+
+    nodes = (CachedNode *)calloc(g_hash_table_size(node_states)+1, sizeof(CachedNode));
+    g_hash_table_iter_init(&iter, node_states);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        NodeState *ns = (NodeState *)value;
+        // nodes that are due to be examined again are not worth keeping
+        if (ns->time==(time_t)-1 || ns->examining)
+            continue;
+        nodes[n_nodes].node = (char *)key;
+        nodes[n_nodes].target = ns->target;
+        nodes[n_nodes].time = ns->time;
+        nodes[n_nodes].dev = ns->dev;
+        ++n_nodes;
+    }
+
+    if (save_device_cache(cache_file, nodes, n_nodes)<0 && verbosity>=1)
+        printf("Could not write the device cache %s\n", cache_file);
+    free(nodes);
+}
+
+// examines every device again, e.g. when the rules for showing them changed
+void reset_device_list() {
+    invalidate_nodes();
+    update_device_list();
+}
+
+/* Events arriving within UEVENT_SETTLE_MS of each other are applied together,
+so that plugging in a hub with several sticks only updates the list once.  A
+continuous stream of events is cut off after UEVENT_SETTLE_MAX_MS. */
+#define UEVENT_SETTLE_MS 250
+#define UEVENT_SETTLE_MAX_MS 1000
+
+UeventSource *uevents = NULL;
+char uevent_file[1024]; // replay events from here instead of netlink
+GHashTable *pending_events = NULL; // /dev name -> the last DeviceEvent for it
+guint settle_timer = 0;
+gint64 settle_start = 0;
+
+typedef enum
+{
+    EVENT_ADD = 1,
+    EVENT_CHANGE,
+    EVENT_REMOVE
+} DeviceEvent;
+
+/**
+Examines the node of a device again after an event, or drops it if the node
+has gone away.
+*/
+void refresh_node(NodeState *ns, int arrived)
+{
+    char *node = strdup(ns->node);
+    char target[1024];
+    struct stat st;
+
+    if(stat(node, &st)<0)
+        remove_node_state(ns);
+    else
+    {
+        get_node_target(node, target, sizeof(target));
+        queue_node(node, target, st.st_mtime, arrived);
+    }
+    free(node);
+}
+
+/**
+Looks for the nodes of devices that were added.  Only nodes that aren't known
+yet are looked at; the others are left to their own events.
+*/
+void add_new_nodes(void)
+{
+    char **nodes;
+    int i;
+
+    nodes = list_device_nodes();
+    for(i=0; nodes && nodes[i]; ++i)
+    {
+        char target[1024];
+        struct stat st;
+
+        if(g_hash_table_lookup(node_states, nodes[i]))
+            continue;
+        get_node_target(nodes[i], target, sizeof(target));
+        if(stat(nodes[i], &st)<0)
+            st.st_mtime = 0;
+        queue_node(nodes[i], target, st.st_mtime, first_scan_done);
+    }
+    free_device_names(nodes);
+}
+
+/**
+Applies the queued device events.  Only the nodes of the devices concerned are
+examined again or dropped; the node directory is only listed when a device was
+added, to find its links.
+*/
+gboolean apply_device_events(gpointer user_data)
+{
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    int added = FALSE;
+
+    settle_timer = 0;
+    if(!pending_events || !g_hash_table_size(pending_events))
+        return FALSE;
+
+    /* Only one scan runs at a time; try again once it is over. */
+    if(scanning)
+    {
+        settle_timer = g_timeout_add(UEVENT_SETTLE_MS, apply_device_events, NULL);
+        return FALSE;
+    }
+
+    if(verbosity>=1)
+        printf("Applying events for %d devices\n", g_hash_table_size(pending_events));
+
+    if(!node_states)
+    {
+        g_hash_table_remove_all(pending_events);
+        update_device_list();
+        return FALSE;
+    }
+
+    load_mount_state();
+    g_hash_table_iter_init(&iter, pending_events);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+        DeviceEvent event = (DeviceEvent)GPOINTER_TO_INT(value);
+        NodeState *ns = (NodeState *)g_hash_table_lookup(nodes_by_target, key);
+
+        /* A device added again may be a different one, with other links. */
+        added |= (event==EVENT_ADD);
+        if(!ns)
+            continue;
+        if(event==EVENT_REMOVE)
+            remove_node_state(ns);
+        else
+            refresh_node(ns, (event==EVENT_ADD && first_scan_done));
+    }
+    g_hash_table_remove_all(pending_events);
+
+    if(added)
+        add_new_nodes();
+    start_scan();
+
+    return FALSE;
+}
+
+/**
+Queues an event for a device and (re)starts the settle timer.  Of several
+events for a device only the last one counts, except that a change doesn't
+make an added device any less new.
+*/
+void queue_device_event(char *devname, char *action)
+{
+    gint64 now = g_get_monotonic_time();
+    DeviceEvent event = EVENT_CHANGE;
+    gpointer old;
+
+    if(action && !strcmp(action, "add"))
+        event = EVENT_ADD;
+    else if(action && !strcmp(action, "remove"))
+        event = EVENT_REMOVE;
+
+    if(!pending_events)
+        pending_events = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    old = g_hash_table_lookup(pending_events, devname);
+    if(!(event==EVENT_CHANGE && GPOINTER_TO_INT(old)==EVENT_ADD))
+        g_hash_table_replace(pending_events, strdup(devname), GINT_TO_POINTER(event));
+
+    if(!settle_timer)
+        settle_start = now;
+    else if(now-settle_start<UEVENT_SETTLE_MAX_MS*1000)
+        g_source_remove(settle_timer);
+    else
+        return;
+
+    settle_timer = g_timeout_add(UEVENT_SETTLE_MS, apply_device_events, NULL);
+}
+
+/**
+Reads events from the uevent source when it becomes readable.
+*/
+gboolean on_uevent(gint fd, GIOCondition condition, gpointer user_data)
+{
+    PropertySet **events;
+    int eof = 0;
+
+    while((events = uevent_read(uevents, &eof)))
+    {
+        int i;
+
+        for(i=0; events[i]; ++i)
+        {
+            char *devname = get_atom_value(events[i], P_DEVNAME);
+
+            if(verbosity>=2)
+                printf("Event %s for %s\n", get_atom_value(events[i], P_ACTION), devname);
+
+            if(devname && match_atom_value(events[i], P_SUBSYSTEM, "block"))
+                queue_device_event(devname, get_atom_value(events[i], P_ACTION));
+        }
+
+        free_uevents(events);
+        if(eof)
             break;
-        case '?':
-            if (optopt == 'f')
-                fprintf (stderr, "option -%c requires an argument.\n", optopt);
-            else if (isprint (optopt))
-                fprintf (stderr, "unknown option `-%c'.\n", optopt);
-            else
-                fprintf (stderr,
-                         "unknown option `\\x%x'.\n",
-                         optopt);
+    }
+
+    if(eof)
+    {
+        uevent_close(uevents);
+        uevents = NULL;
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+Starts listening for device events.  Without a replay file, the udev netlink
+group is used; if that is not available the list is only updated by the
+Refresh button.
+*/
+void watch_device_events(void)
+{
+    if(uevent_file[0])
+    {
+        int fd = open(uevent_file, O_RDONLY|O_CLOEXEC);
+        if(fd==-1)
+        {
+            fprintf(stderr, "can't open %s\n", uevent_file);
+            return;
+        }
+        uevents = uevent_open_stream(fd);
+    }
+    else
+        uevents = uevent_open_netlink();
+
+    if(!uevents)
+    {
+        if(verbosity>=1)
+            printf("Device events are not available\n");
+        return;
+    }
+
+    g_unix_fd_add(uevents->fd, G_IO_IN|G_IO_HUP|G_IO_ERR, on_uevent, NULL);
+}
+
+/**
+Updates a device's mount state and its row, without triggering a mount or
+unmount.
+*/
+void set_device_mount(Device *dev, MountEntry *me)
+{
+    int was_mounted = dev->mounted;
+
+    free(dev->mountpoint);
+    dev->mountpoint = (me ? strdup(me->mountpoint) : NULL);
+    dev->mounted = (me!=NULL);
+
+    if(verbosity>=1)
+        printf("%s is %s\n", dev->shortdev, (me ? me->mountpoint : "not mounted"));
+
+    // show or drop the space; a mount also ends "safe to remove"
+    if(!dev->job && (dev->mounted || was_mounted))
+        set_device_label(dev, NULL);
+    else
+        update_device_row(dev);
+    query_device_space(dev);
+}
+
+/**
+Called when the kernel reports a change in the mount table.  Only rows of
+devices whose mount state changed are touched.
+*/
+gboolean on_mounts_changed(gint fd, GIOCondition condition, gpointer user_data)
+{
+    char fnbuf[1024];
+    MountTable *table;
+    dev_t *changed;
+    int n_changed;
+    double start;
+    int i;
+
+    start = trace_now();
+    snprintf(fnbuf, sizeof(fnbuf), "%s/proc/self/mountinfo", sysroot);
+    table = read_mount_table(fnbuf);
+    trace_span(T_MOUNT_TABLE, start, fnbuf);
+    if(!table)
+        return G_SOURCE_CONTINUE;
+
+    changed = diff_mount_tables(mount_table, table, &n_changed);
+    free_mount_table(mount_table);
+    mount_table = table;
+
+    for(i=0; i<n_changed; ++i)
+    {
+        int j;
+        for(j=0; (devices && devices[j]); ++j)
+            if(devices[j]->devnum==changed[i])
+                set_device_mount(devices[j], find_mount(mount_table, changed[i]));
+    }
+    free(changed);
+    // writes to mounted filesystems don't show up here, but mounts do
+    refresh_space(NULL);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+Called when something in /etc changes.  If fstab was touched, the set of
+user-mountable devices is read again and the list is refreshed, since that
+decides which devices are shown.
+*/
+gboolean on_etc_changed(gint fd, GIOCondition condition, gpointer user_data)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int fstab_changed = FALSE;
+    int len;
+
+    while((len = read(fd, buf, sizeof(buf)))>0)
+    {
+        char *ptr;
+        for(ptr=buf; ptr<buf+len; )
+        {
+            struct inotify_event *ev = (struct inotify_event *)ptr;
+            if(ev->len && !strcmp(ev->name, "fstab"))
+                fstab_changed = TRUE;
+            ptr += sizeof(struct inotify_event)+ev->len;
         }
+    }
 
+    if(fstab_changed)
+    {
+        if(verbosity>=1)
+            printf("fstab changed\n");
+        double start = trace_now();
+        reload_fstab_set();
+        trace_span(T_MOUNT_TABLE, start, "fstab");
+        reset_device_list();
+    }
 
+    return G_SOURCE_CONTINUE;
+}
 
-    gtk_init(&argc, &argv);
+/**
+Starts watching /proc/self/mountinfo and /etc/fstab so that mount state stays
+correct when devices are mounted or unmounted by other programs.  The kernel
+signals mount table changes with POLLPRI on mountinfo.  Editors usually
+replace fstab rather than writing to it, so its directory is watched.
+*/
+void watch_mounts(void)
+{
+    char fnbuf[1024];
+    int fd;
 
-    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    snprintf(fnbuf, sizeof(fnbuf), "%s/proc/self/mountinfo", sysroot);
+    fd = open(fnbuf, O_RDONLY|O_CLOEXEC);
+    if(fd==-1)
+    {
+        if(verbosity>=1)
+            printf("Mount table changes are not available\n");
+        return;
+    }
+    g_unix_fd_add(fd, G_IO_PRI|G_IO_ERR, on_mounts_changed, NULL);
 
-    GtkWidget* button = gtk_button_new_with_label((gchar*)"Refresh");
+    snprintf(fnbuf, sizeof(fnbuf), "%s/etc", sysroot);
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(fd!=-1 && inotify_add_watch(fd, fnbuf, IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE)!=-1)
+    {
+        g_unix_fd_add(fd, G_IO_IN, on_etc_changed, NULL);
+        // both files are watched, enumerations can use the cached state
+        mounts_watched = TRUE;
+    }
+    else if(fd!=-1)
+        close(fd);
+}
+
+// records how long it took until the window was first drawn
+gboolean on_first_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+    trace_span(T_FIRST_FRAME, 0, NULL);
+    g_signal_handlers_disconnect_by_func(widget, on_first_draw, user_data);
+    return FALSE;
+}
+
+/* Launching the program again activates the running instance instead of
+starting a new one.  When the window is closed the process can stay resident,
+with the window hidden and the device table kept up to date, for
+resident_seconds; activating it then shows the table straight away.  Starting
+hidden without -r stays resident for DEFAULT_RESIDENT_S, since a hidden window
+nobody has opened yet would otherwise end the program at once. */
+#define APP_ID "io.github.Arlon1.PmountGuiNg"
+#define DEFAULT_RESIDENT_S 600
+
+int resident_seconds = 0;
+int start_hidden = FALSE;
+int activated = FALSE;
+guint resident_timer = 0;
+
+// quits, or hides the window and quits once the running mounts and unmounts
+// are over, so that none of them is abandoned halfway
+void quit_when_done() {
+    if (!n_jobs) {
+        gtk_widget_destroy(window);
+        return;
+    }
+    if (verbosity>=1)
+        printf("waiting for %d jobs before quitting\n", n_jobs);
+    gtk_widget_hide(window);
+    quit_pending = TRUE;
+}
+
+// quits once the window has been closed for the resident period
+gboolean on_resident_timeout(gpointer user_data) {
+    resident_timer = 0;
+    if (verbosity>=1)
+        printf("resident period is over\n");
+    quit_when_done();
+    return FALSE;
+}
+
+// closes the window, or hides it if the process stays resident
+void close_window() {
+    if (resident_seconds<=0) {
+        quit_when_done();
+        return;
+    }
+
+    gtk_widget_hide(window);
+    if (resident_timer)
+        g_source_remove(resident_timer);
+    resident_timer = g_timeout_add_seconds(resident_seconds, on_resident_timeout, NULL);
+}
+
+gboolean on_delete(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    close_window();
+    return TRUE;
+}
 
-    list = gtk_list_box_new ();
+void on_no_devices_response(GtkDialog *dialog, gint response, gpointer user_data) {
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+    close_window();
+}
+
+gboolean checkDevices(gpointer user_data) {
+    // nobody to tell while the window is hidden
+    if (!gtk_widget_get_visible(window))
+        return FALSE;
+    if (!devices || !devices[0]) {
+        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_MODAL, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
+                            "Sorry couldn't find any appropriate devices");
+        g_signal_connect(dialog, "response", G_CALLBACK(on_no_devices_response), NULL);
+        gtk_widget_show_all(dialog);
+
+    }
+    return FALSE;
+}
+
+// builds the window and starts following devices; only runs in the
+// primary instance
+void on_startup(GApplication *app, gpointer user_data) {
+    window = gtk_application_window_new(GTK_APPLICATION(app));
+
+    GtkWidget* button = gtk_button_new_with_label((gchar*)"Refresh");
     GtkWidget* vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+    GtkWidget* scrolled = gtk_scrolled_window_new(NULL, NULL);
+    GtkTreeViewColumn* column = gtk_tree_view_column_new();
+    GtkCellRenderer* tick = gtk_cell_renderer_toggle_new();
+    GtkCellRenderer* text = gtk_cell_renderer_text_new();
+
+    device_store = gtk_list_store_new(N_COLUMNS, G_TYPE_POINTER, G_TYPE_STRING);
+    device_filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(device_store), NULL);
+    gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(device_filter), is_device_visible, NULL, NULL);
+    device_view = gtk_tree_view_new_with_model(device_filter);
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(device_view), FALSE);
+    gtk_tree_view_set_enable_search(GTK_TREE_VIEW(device_view), FALSE);
+
+    gtk_tree_view_column_pack_start(column, tick, FALSE);
+    gtk_tree_view_column_set_cell_data_func(column, tick, render_device_toggle, NULL, NULL);
+    g_object_set(text, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+    gtk_tree_view_column_pack_start(column, text, TRUE);
+    gtk_tree_view_column_set_cell_data_func(column, text, render_device_text, NULL, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_expand(column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(device_view), column);
+    // all rows are as high as the first, so only the visible ones are measured
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(device_view), TRUE);
+    gtk_widget_set_has_tooltip(device_view, TRUE);
+
+    g_signal_connect(tick, "toggled", G_CALLBACK(on_device_toggled), NULL);
+    g_signal_connect(device_view, "row-activated", G_CALLBACK(on_row_activated), NULL);
+    g_signal_connect(device_view, "query-tooltip", G_CALLBACK(on_query_tooltip), NULL);
+    g_signal_connect(device_view, "button-press-event", G_CALLBACK(on_view_button_press), NULL);
+    g_signal_connect(device_view, "popup-menu", G_CALLBACK(on_view_popup_menu), NULL);
+
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(scrolled), TRUE);
+    gtk_scrolled_window_set_max_content_height(GTK_SCROLLED_WINDOW(scrolled), 600);
+    gtk_container_add(GTK_CONTAINER(scrolled), device_view);
+
+    filter_entry = gtk_search_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(filter_entry), "Filter by label, device, vendor or model");
+    g_signal_connect(filter_entry, "search-changed", G_CALLBACK(on_filter_changed), NULL);
+    g_signal_connect(filter_entry, "stop-search", G_CALLBACK(on_filter_stopped), NULL);
+    g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), NULL);
 
     gtk_container_add(GTK_CONTAINER(window), vbox);
+    gtk_window_set_default_size(GTK_WINDOW(window), 480, -1);
     // do i need the button ??? cancel ???
     gtk_container_add(GTK_CONTAINER(vbox), button);
-    gtk_container_add(GTK_CONTAINER(vbox), list);
+    gtk_container_add(GTK_CONTAINER(vbox), filter_entry);
+    scanning_label = gtk_label_new("scanning...");
+    gtk_container_add(GTK_CONTAINER(vbox), scanning_label);
+    gtk_box_pack_start(GTK_BOX(vbox), scrolled, TRUE, TRUE, 0);
 
     g_signal_connect(G_OBJECT(button), "clicked",
                      G_CALLBACK(update_device_list), NULL);
 
-    update_device_list();
-
-    enable_callbacks=TRUE;  // just so they don't fire when setting up active states
+    // listen before enumerating so no events are missed
+    watch_device_events();
+    watch_mounts();
+    // show the cached rows at once and check them once the window is up
+    if (load_cached_device_list())
+        g_idle_add(revalidate_device_list, NULL);
+    else
+        update_device_list();
 
-    g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+    g_signal_connect(window, "delete-event", G_CALLBACK(on_delete), NULL);
+    g_timeout_add_seconds(SPACE_REFRESH_S, refresh_space, NULL);
 
     gtk_widget_show(button);
-    gtk_widget_show(list);
+    gtk_widget_show(filter_entry);
+    gtk_widget_show(device_view);
+    gtk_widget_show(scrolled);
     gtk_widget_show(vbox);
-    gtk_widget_show(window);
+    if (tracing)
+        g_signal_connect_after(window, "draw", G_CALLBACK(on_first_draw), NULL);
+}
+
+// shows the window, both for the first launch and for later ones
+void on_activate(GApplication *app, gpointer user_data) {
+    int first = !activated;
+
+    activated = TRUE;
+    if (first && start_hidden) {
+        close_window();
+        return;
+    }
+
+    if (resident_timer) {
+        g_source_remove(resident_timer);
+        resident_timer = 0;
+    }
+    quit_pending = FALSE;
+
+    if (!first) {
+        if (verbosity>=1)
+            printf("activated again\n");
+        // the table is kept up to date, but pick up anything that was missed
+        update_device_list();
+        if (first_scan_done)
+            g_idle_add(checkDevices, NULL);
+    }
+
+    gtk_window_present(GTK_WINDOW(window));
+}
+
+int main(int argc, char** argv)
+{
+    filemanager[0]=0;
+    int show_summary=FALSE;
+    int use_cache=TRUE;
+    char trace_file[1024];
+    trace_file[0]=0;
+    char rules_file[1024];
+    rules_file[0]=0;
+    profiles_file[0]=0;
+    GtkApplication *app;
+    int status;
+    int opt;
+    while((opt = getopt(argc, argv, "vhksnbr:f:R:S:ceE:u:T:w:a:DW:P:"))!=-1) switch(opt)
+        {
+        case 'v':
+            ++verbosity;
+            break;
+        case 'k':
+            okfeedback=TRUE;
+            break;
+        case 's':
+            show_summary=TRUE;
+            break;
+        case 'n':
+            use_cache=FALSE;
+            break;
+        case 'r':
+            resident_seconds=atoi(optarg);
+            break;
+        case 'b':
+            start_hidden=TRUE;
+            break;
+        case 'T':
+            snprintf(trace_file,sizeof(trace_file),"%s",optarg);
+            break;
+        case 'f':
+            snprintf(filemanager,1024,"%s",optarg);
+            break;
+        case 'e':
+            use_export_db=TRUE;
+            break;
+        case 'E':
+            use_export_db=TRUE;
+            snprintf(export_db_file,sizeof(export_db_file),"%s",optarg);
+            break;
+        case 'u':
+            snprintf(uevent_file,sizeof(uevent_file),"%s",optarg);
+            break;
+        case 'R':
+            snprintf(sysroot,sizeof(sysroot),"%s",optarg);
+            break;
+        case 'S':
+            snprintf(sysfs_root,sizeof(sysfs_root),"%s",optarg);
+            break;
+        case 'c':
+            use_sysfs_enumeration=TRUE;
+            break;
+        case 'w':
+            if (set_child_timeouts(optarg)<0)
+                fprintf (stderr, "invalid timeouts %s\n", optarg);
+            break;
+        case 'a':
+            snprintf(rules_file,sizeof(rules_file),"%s",optarg);
+            break;
+        case 'D':
+            dry_run=TRUE;
+            break;
+        case 'P':
+            snprintf(profiles_file,sizeof(profiles_file),"%s",optarg);
+            break;
+        case 'W':
+            if (set_warmup_limits(optarg)<0)
+                fprintf (stderr, "invalid warm-up limits %s\n", optarg);
+            break;
+        case 'h':
+            printf("-v verbosity  -k extra feedback  -h help! \n");
+            printf("-f 'application [args]' (started in newly mounted\n");
+            printf("media, %%m in args is replaced by the mount path)\n");
+            printf("-R root (read /dev, /sys and /run/udev below root,\n");
+            printf("for testing against a fixture directory)\n");
+            printf("-S dir (read sysfs from dir instead of /sys)\n");
+            printf("-c enumerate the block devices in sysfs instead of\n");
+            printf("/dev/disk/by-id\n");
+            printf("-e enumerate with one udevadm info --export-db\n");
+            printf("-E file (as -e but read a saved --export-db dump)\n");
+            printf("-u file (replay udevadm monitor --property output\n");
+            printf("instead of listening for device events)\n");
+            printf("-T file (write a Chrome trace of the time spent in\n");
+            printf("each stage)  -s print a summary of the stages at exit\n");
+            printf("-n don't use the device cache\n");
+            printf("-r seconds (stay resident with the window hidden for\n");
+            printf("this long after it is closed)\n");
+            printf("-b start hidden and resident, for 600 seconds\n");
+            printf("unless -r is given\n");
+            printf("-w class=seconds,... (timeouts of the udevadm, pmount\n");
+            printf("and pumount commands, 0 for none)\n");
+            printf("-a file (read automount rules from file instead of\n");
+            printf("~/.config/pmount-gui-ng/rules)\n");
+            printf("-D print the rule each device matches instead of\n");
+            printf("automounting\n");
+            printf("-P file (read and save mount options in file instead\n");
+            printf("of ~/.config/pmount-gui-ng/profiles)\n");
+            printf("-W on|depth=n,entries=n,ms=n,threads=n (read the\n");
+            printf("directories of a new mount into the cache before\n");
+            printf("starting the -f application)\n");
+            printf("options only take effect when no instance is running\n");
+            return 0;
+            break;
+        case '?':
+            if (optopt == 'f' || optopt == 'R' || optopt == 'S' || optopt == 'E' || optopt == 'u' || optopt == 'T' || optopt == 'r' || optopt == 'w' || optopt == 'a' || optopt == 'W' || optopt == 'P')
+                fprintf (stderr, "option -%c requires an argument.\n", optopt);
+            else if (isprint (optopt))
+                fprintf (stderr, "unknown option `-%c'.\n", optopt);
+            else
+                fprintf (stderr,
+                         "unknown option `\\x%x'.\n",
+                         optopt);
+        }
 
-    // check devices after gtk has realised the window
-    g_idle_add (checkDevices,NULL);
 
-    gtk_main();
 
+    if (start_hidden && resident_seconds<=0)
+        resident_seconds = DEFAULT_RESIDENT_S;
+    if (filemanager[0]) {
+        GError *error = NULL;
+        if (!g_shell_parse_argv(filemanager, NULL, &app_argv, &error)) {
+            fprintf (stderr, "invalid application %s: %s\n", filemanager, error->message);
+            g_error_free(error);
+        }
+    }
+    if (show_summary || trace_file[0])
+        start_tracing();
+    if (!use_cache || get_cache_filename(cache_file, sizeof(cache_file))<0)
+        cache_file[0]=0;
+    // compiled once, so devices are matched as soon as they are examined
+    if (rules_file[0] || get_rules_filename(rules_file, sizeof(rules_file))==0)
+        automount_rules = load_rules(rules_file);
+    if (profiles_file[0] || get_profiles_filename(profiles_file, sizeof(profiles_file))==0)
+        mount_profiles = load_profiles(profiles_file);
+    else
+        mount_profiles = (ProfileSet *)calloc(1, sizeof(ProfileSet));
+
+    app = gtk_application_new(APP_ID, G_APPLICATION_FLAGS_NONE);
+    g_signal_connect(app, "startup", G_CALLBACK(on_startup), NULL);
+    g_signal_connect(app, "activate", G_CALLBACK(on_activate), NULL);
+    // our options have been handled already
+    status = g_application_run(G_APPLICATION(app), 1, argv);
+    g_object_unref(app);
+
+    save_cached_device_list();
+    if (show_summary)
+        print_trace_summary(stderr);
+    if (trace_file[0] && write_trace(trace_file)<0)
+        fprintf(stderr, "can't write %s\n", trace_file);
+    free_trace();
     free_devices(devices);
+    free_rules(automount_rules);
+    free_profiles(mount_profiles);
+    g_strfreev(app_argv);
 
-    return 0;
+    return status;
 }
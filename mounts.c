@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <sys/statvfs.h>
+#include "udev.h"
+#include "mounts.h"
+
+/**
+Undoes the octal escapes (\040 for space etc.) used in mountinfo fields.  The
+string is modified in place.
+*/
+static void unescape_field(char *str)
+{
+    char *out = str;
+
+    for(; *str; ++str)
+    {
+        if(str[0]=='\\' && str[1]>='0' && str[1]<='3' && str[2]>='0' && str[2]<='7' && str[3]>='0' && str[3]<='7')
+        {
+            *out++ = (str[1]-'0')*64+(str[2]-'0')*8+(str[3]-'0');
+            str += 3;
+        }
+        else
+            *out++ = *str;
+    }
+    *out = 0;
+}
+
+/**
+Orders mount entries by device number.  Ties keep their mountinfo order, which
+puts earlier mounts first.
+*/
+static int compare_mounts(const void *a, const void *b)
+{
+    const MountEntry *ma = (const MountEntry *)a;
+    const MountEntry *mb = (const MountEntry *)b;
+
+    if(ma->devnum!=mb->devnum)
+        return (ma->devnum<mb->devnum ? -1 : 1);
+    return ma->order-mb->order;
+}
+
+/**
+Parses the contents of a mountinfo file.  Each line looks like
+
+  36 35 98:0 /root /mnt/point rw,noatime master:1 - ext3 /dev/sda1 rw
+
+where the optional fields before the - separator vary in number.  The buffer
+is modified.
+*/
+MountTable *parse_mountinfo(char *buf)
+{
+    MountTable *table;
+    int n_alloc = 0;
+    char *line;
+    char *end;
+
+    table = (MountTable *)calloc(1, sizeof(MountTable));
+
+    for(line=buf; *line; line=end)
+    {
+        char *fields[16];
+        int n_fields = 0;
+        char *ptr;
+        unsigned maj;
+        unsigned min;
+        int sep;
+        MountEntry *me;
+
+        for(end=line; (*end && *end!='\n'); ++end) ;
+        if(*end)
+            *end++ = 0;
+
+        for(ptr=line; (*ptr && n_fields<16); )
+        {
+            while(*ptr==' ')
+                *ptr++ = 0;
+            if(!*ptr)
+                break;
+            fields[n_fields++] = ptr;
+            while(*ptr && *ptr!=' ')
+                ++ptr;
+        }
+
+        for(sep=6; (sep<n_fields && strcmp(fields[sep], "-")); ++sep) ;
+        if(sep+2>=n_fields || sscanf(fields[2], "%u:%u", &maj, &min)!=2)
+            continue;
+
+        /* Filesystems without a backing device, such as tmpfs or btrfs
+        subvolumes, use anonymous major 0. */
+        if(maj==0)
+            continue;
+
+        if(table->n_entries>=n_alloc)
+        {
+            n_alloc = (n_alloc ? n_alloc*2 : 32);
+            table->entries = (MountEntry *)realloc(table->entries, n_alloc*sizeof(MountEntry));
+        }
+
+        unescape_field(fields[4]);
+        unescape_field(fields[sep+2]);
+
+        me = &table->entries[table->n_entries++];
+        me->devnum = makedev(maj, min);
+        me->order = table->n_entries;
+        me->mountpoint = strdup(fields[4]);
+        me->fstype = strdup(fields[sep+1]);
+        me->source = strdup(fields[sep+2]);
+    }
+
+    if(table->n_entries)
+        qsort(table->entries, table->n_entries, sizeof(MountEntry), &compare_mounts);
+
+    return table;
+}
+
+/**
+Reads a mountinfo file, usually /proc/self/mountinfo.  Returns NULL if the file
+could not be read.
+*/
+MountTable *read_mount_table(char *filename)
+{
+    MountTable *table;
+    char *buf;
+
+    buf = read_small_file(filename, NULL);
+    if(!buf)
+        return NULL;
+
+    table = parse_mountinfo(buf);
+    free(buf);
+
+    return table;
+}
+
+/**
+Finds the first mount of a device.  Returns NULL if the device is not mounted.
+*/
+MountEntry *find_mount(MountTable *table, dev_t devnum)
+{
+    int low = 0;
+    int high;
+
+    if(!table)
+        return NULL;
+
+    /* Find the lowest index with a matching device number. */
+    high = table->n_entries;
+    while(low<high)
+    {
+        int mid = (low+high)/2;
+        if(table->entries[mid].devnum<devnum)
+            low = mid+1;
+        else
+            high = mid;
+    }
+
+    if(low<table->n_entries && table->entries[low].devnum==devnum)
+        return &table->entries[low];
+    return NULL;
+}
+
+/**
+Compares two mount tables and returns the device numbers whose first mount
+differs between them, i.e. devices that were mounted, unmounted or moved.  The
+number of devices is stored in count.  Returns NULL if nothing changed.
+*/
+dev_t *diff_mount_tables(MountTable *old_table, MountTable *new_table, int *count)
+{
+    dev_t *changed = NULL;
+    int n_old = (old_table ? old_table->n_entries : 0);
+    int n_new = (new_table ? new_table->n_entries : 0);
+    int i = 0;
+    int j = 0;
+
+    *count = 0;
+    while(i<n_old || j<n_new)
+    {
+        MountEntry *om = (i<n_old ? &old_table->entries[i] : NULL);
+        MountEntry *nm = (j<n_new ? &new_table->entries[j] : NULL);
+        dev_t devnum;
+        int differs;
+
+        if(om && (!nm || om->devnum<nm->devnum))
+        {
+            devnum = om->devnum;
+            differs = 1;
+        }
+        else if(nm && (!om || nm->devnum<om->devnum))
+        {
+            devnum = nm->devnum;
+            differs = 1;
+        }
+        else
+        {
+            devnum = om->devnum;
+            differs = strcmp(om->mountpoint, nm->mountpoint);
+        }
+
+        if(differs)
+        {
+            changed = (dev_t *)realloc(changed, (*count+1)*sizeof(dev_t));
+            changed[(*count)++] = devnum;
+        }
+
+        /* Skip further mounts of the same device in both tables. */
+        while(i<n_old && old_table->entries[i].devnum==devnum)
+            ++i;
+        while(j<n_new && new_table->entries[j].devnum==devnum)
+            ++j;
+    }
+
+    return changed;
+}
+
+/**
+Reads the size and usage of the filesystem mounted on a directory.  This may
+block for a long time if the device doesn't respond.  Returns 0 on success or
+-1 on failure.
+*/
+int get_mount_space(char *mountpoint, MountSpace *space)
+{
+    struct statvfs st;
+
+    if(statvfs(mountpoint, &st)<0)
+        return -1;
+
+    space->size = (unsigned long long)st.f_blocks*st.f_frsize;
+    space->used = (unsigned long long)(st.f_blocks-st.f_bfree)*st.f_frsize;
+    space->avail = (unsigned long long)st.f_bavail*st.f_frsize;
+
+    return 0;
+}
+
+/**
+Formats a number of bytes for people, e.g. "15.9 GB".
+*/
+void format_size(unsigned long long bytes, char *buf, int size)
+{
+    static char *units[] = { "B", "kB", "MB", "GB", "TB", "PB" };
+    double value = bytes;
+    int unit = 0;
+
+    while(value>=1000 && unit<5)
+    {
+        value /= 1024;
+        ++unit;
+    }
+
+    if(unit==0)
+        snprintf(buf, size, "%llu B", bytes);
+    else
+        snprintf(buf, size, "%.1f %s", value, units[unit]);
+}
+
+/**
+Frees a mount table and all strings contained in it.
+*/
+void free_mount_table(MountTable *table)
+{
+    int i;
+    if(!table)
+        return;
+    for(i=0; i<table->n_entries; ++i)
+    {
+        free(table->entries[i].mountpoint);
+        free(table->entries[i].source);
+        free(table->entries[i].fstype);
+    }
+    free(table->entries);
+    free(table);
+}
@@ -0,0 +1,41 @@
+#ifndef MOUNTS_H
+#define MOUNTS_H
+
+#include <sys/types.h>
+
+/* A mounted filesystem from /proc/self/mountinfo. */
+typedef struct sMountEntry
+{
+    dev_t devnum;
+    char *mountpoint;
+    char *source;
+    char *fstype;
+    int order; // position in mountinfo
+} MountEntry;
+
+/* All mounts, sorted by device number.  If a device is mounted more than once,
+the earliest mount comes first. */
+typedef struct sMountTable
+{
+    MountEntry *entries;
+    int n_entries;
+} MountTable;
+
+/* Capacity of a mounted filesystem, in bytes.  avail is what unprivileged
+users can still write. */
+typedef struct sMountSpace
+{
+    unsigned long long size;
+    unsigned long long used;
+    unsigned long long avail;
+} MountSpace;
+
+MountTable *parse_mountinfo(char *buf);
+MountTable *read_mount_table(char *filename);
+MountEntry *find_mount(MountTable *table, dev_t devnum);
+dev_t *diff_mount_tables(MountTable *old_table, MountTable *new_table, int *count);
+int get_mount_space(char *mountpoint, MountSpace *space);
+void format_size(unsigned long long bytes, char *buf, int size);
+void free_mount_table(MountTable *table);
+
+#endif
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "udev.h"
+#include "rules.h"
+#include "profiles.h"
+
+/* The profiles file has a line for each profile: what it applies to, followed
+by the options that differ from pmount's defaults.
+
+  # photos from the camera card: fast, and private
+  uuid=3A2F-1C04 noatime umask=077
+  serial=Kingston_DataTraveler_3.0_60A44C3FAE sync
+  fstype=vfat noatime charset=utf8
+
+A profile for the filesystem's UUID comes first, then one for the drive's
+serial, then one for the filesystem type.  The GUI rewrites the file when a
+profile is edited, so comments are not kept. */
+
+ProfileSet *mount_profiles = NULL;
+
+static char *key_kinds[] = { "uuid=", "serial=", "fstype=", NULL };
+
+int get_profiles_filename(char *buf, int size)
+{
+    return get_config_filename("profiles", buf, size);
+}
+
+/**
+Checks that a string is made of at least min and at most max characters from
+chars.
+*/
+static int is_made_of(char *str, char *chars, int min, int max)
+{
+    int len = strlen(str);
+
+    return (len>=min && len<=max && (int)strspn(str, chars)==len);
+}
+
+/**
+Sets one option of a profile, as written in the profiles file, e.g. noatime or
+umask=077.  Returns 0 on success or -1 if the option is not valid.
+*/
+int parse_profile_option(MountProfile *profile, char *option)
+{
+    if(!strcmp(option, "defaults"))
+        return 0;
+    else if(!strcmp(option, "sync") || !strcmp(option, "async"))
+        profile->sync = (option[0]=='s');
+    else if(!strcmp(option, "noatime") || !strcmp(option, "atime"))
+        profile->noatime = (option[0]=='n');
+    else if(!strcmp(option, "readonly") || !strcmp(option, "readwrite"))
+        profile->read_only = (option[4]=='o');
+    else if(!strncmp(option, "umask=", 6) && is_made_of(option+6, "01234567", 3, 4))
+    {
+        free(profile->umask);
+        profile->umask = strdup(option+6);
+    }
+    else if(!strncmp(option, "charset=", 8) && is_made_of(option+8,
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-", 1, 31))
+    {
+        free(profile->charset);
+        profile->charset = strdup(option+8);
+    }
+    else
+        return -1;
+
+    return 0;
+}
+
+static int is_valid_key(char *key)
+{
+    int i;
+
+    for(i=0; key_kinds[i]; ++i)
+        if(!strncmp(key, key_kinds[i], strlen(key_kinds[i])) && key[strlen(key_kinds[i])])
+            return 1;
+
+    return 0;
+}
+
+static void clear_profile(MountProfile *profile)
+{
+    free(profile->key);
+    free(profile->umask);
+    free(profile->charset);
+}
+
+/**
+Adds a profile for a line of the profiles file.  Returns 0 on success or -1 if
+the line is not a valid profile.
+*/
+static int parse_profile(ProfileSet *set, char *line, int lineno, char *filename)
+{
+    MountProfile profile;
+    char *saveptr;
+    char *word;
+
+    memset(&profile, 0, sizeof(MountProfile));
+    word = strtok_r(line, " \t", &saveptr);
+    if(!is_valid_key(word))
+    {
+        fprintf(stderr, "%s:%d: expected uuid=, serial= or fstype= instead of %s\n", filename, lineno, word);
+        return -1;
+    }
+    if(find_profile(set, word))
+    {
+        fprintf(stderr, "%s:%d: %s has a profile already\n", filename, lineno, word);
+        return -1;
+    }
+    profile.key = strdup(word);
+
+    while((word = strtok_r(NULL, " \t", &saveptr)))
+    {
+        if(parse_profile_option(&profile, word)<0)
+        {
+            fprintf(stderr, "%s:%d: invalid option %s\n", filename, lineno, word);
+            clear_profile(&profile);
+            return -1;
+        }
+    }
+
+    set->profiles = (MountProfile *)realloc(set->profiles, (set->n_profiles+1)*sizeof(MountProfile));
+    set->profiles[set->n_profiles++] = profile;
+
+    return 0;
+}
+
+/**
+Reads a profiles file.  Invalid lines are reported and skipped.  A missing
+file gives an empty set, so that profiles can be added to it.
+*/
+ProfileSet *load_profiles(char *filename)
+{
+    ProfileSet *set;
+    char *buf;
+    char *line;
+    char *end;
+    int lineno = 0;
+
+    set = (ProfileSet *)calloc(1, sizeof(ProfileSet));
+    buf = read_small_file(filename, NULL);
+    if(!buf)
+        return set;
+
+    for(line=buf; *line; line=end)
+    {
+        char *ptr;
+
+        ++lineno;
+        end = strchr(line, '\n');
+        if(end)
+            *end++ = 0;
+        else
+            end = line+strlen(line);
+
+        for(ptr=line; (*ptr==' ' || *ptr=='\t'); ++ptr) ;
+        if(!*ptr || *ptr=='#')
+            continue;
+        parse_profile(set, ptr, lineno, filename);
+    }
+    free(buf);
+
+    if(verbosity>=1)
+        printf("Read %d mount profiles from %s\n", set->n_profiles, filename);
+
+    return set;
+}
+
+/**
+Writes a profile as a line of the profiles file.
+*/
+static void write_profile(FILE *file, MountProfile *profile)
+{
+    fputs(profile->key, file);
+    if(!profile->sync && !profile->noatime && !profile->read_only && !profile->umask && !profile->charset)
+        fputs(" defaults", file);
+    if(profile->sync)
+        fputs(" sync", file);
+    if(profile->noatime)
+        fputs(" noatime", file);
+    if(profile->read_only)
+        fputs(" readonly", file);
+    if(profile->umask)
+        fprintf(file, " umask=%s", profile->umask);
+    if(profile->charset)
+        fprintf(file, " charset=%s", profile->charset);
+    fputc('\n', file);
+}
+
+/**
+Writes a profiles file, replacing it atomically.  Returns 0 on success or -1
+on failure.
+*/
+int save_profiles(ProfileSet *set, char *filename)
+{
+    char tmpname[1100];
+    FILE *file;
+    int i;
+
+    make_file_dir(filename);
+    snprintf(tmpname, sizeof(tmpname), "%s.%d", filename, (int)getpid());
+    file = fopen(tmpname, "w");
+    if(!file)
+        return -1;
+
+    fputs("# pmount options by filesystem uuid=, drive serial= or fstype=\n", file);
+    for(i=0; i<set->n_profiles; ++i)
+        write_profile(file, &set->profiles[i]);
+
+    if(fclose(file)!=0 || rename(tmpname, filename)<0)
+    {
+        unlink(tmpname);
+        return -1;
+    }
+
+    return 0;
+}
+
+MountProfile *find_profile(ProfileSet *set, char *key)
+{
+    int i;
+
+    if(!set)
+        return NULL;
+
+    for(i=0; i<set->n_profiles; ++i)
+        if(!strcmp(set->profiles[i].key, key))
+            return &set->profiles[i];
+
+    return NULL;
+}
+
+/**
+Finds the profile that applies to a device: the one for its filesystem, for
+its drive, or for its type of filesystem, in that order.  Any of the keys may
+be NULL.  Returns NULL if there is none.
+*/
+MountProfile *match_profile(ProfileSet *set, char *uuid, char *serial, char *fs_type)
+{
+    char *values[] = { uuid, serial, fs_type };
+    int i;
+
+    for(i=0; key_kinds[i]; ++i)
+    {
+        MountProfile *profile;
+        char key[1024];
+
+        if(!values[i] || !values[i][0])
+            continue;
+        snprintf(key, sizeof(key), "%s%s", key_kinds[i], values[i]);
+        if((profile = find_profile(set, key)))
+            return profile;
+    }
+
+    return NULL;
+}
+
+/**
+Returns the profile for a key, adding one with pmount's defaults if there is
+none.  Pointers to profiles of the set are invalid afterwards.
+*/
+MountProfile *set_profile(ProfileSet *set, char *key)
+{
+    MountProfile *profile = find_profile(set, key);
+
+    if(profile)
+        return profile;
+
+    set->profiles = (MountProfile *)realloc(set->profiles, (set->n_profiles+1)*sizeof(MountProfile));
+    profile = &set->profiles[set->n_profiles++];
+    memset(profile, 0, sizeof(MountProfile));
+    profile->key = strdup(key);
+
+    return profile;
+}
+
+void remove_profile(ProfileSet *set, char *key)
+{
+    MountProfile *profile = find_profile(set, key);
+
+    if(!profile)
+        return;
+
+    clear_profile(profile);
+    --set->n_profiles;
+    memmove(profile, profile+1, (set->profiles+set->n_profiles-profile)*sizeof(MountProfile));
+}
+
+/**
+Adds the pmount arguments for a profile to argv, which must have room for
+MAX_PROFILE_ARGS more.  Returns the new number of arguments.
+*/
+int add_profile_args(MountProfile *profile, char **argv, int argc)
+{
+    if(profile->sync)
+        argv[argc++] = "-s";
+    if(profile->noatime)
+        argv[argc++] = "-A";
+    if(profile->read_only)
+        argv[argc++] = "-r";
+    if(profile->umask)
+    {
+        argv[argc++] = "-u";
+        argv[argc++] = profile->umask;
+    }
+    if(profile->charset)
+    {
+        argv[argc++] = "-c";
+        argv[argc++] = profile->charset;
+    }
+
+    return argc;
+}
+
+/**
+Writes the options of a profile to buf for people, e.g. "noatime, umask 077".
+*/
+void describe_profile(MountProfile *profile, char *buf, int size)
+{
+    int pos = 0;
+
+    buf[0] = 0;
+    if(profile->sync)
+        pos += snprintf(buf+pos, size-pos, "%ssync", (pos ? ", " : ""));
+    if(profile->noatime && pos<size)
+        pos += snprintf(buf+pos, size-pos, "%snoatime", (pos ? ", " : ""));
+    if(profile->read_only && pos<size)
+        pos += snprintf(buf+pos, size-pos, "%sread-only", (pos ? ", " : ""));
+    if(profile->umask && pos<size)
+        pos += snprintf(buf+pos, size-pos, "%sumask %s", (pos ? ", " : ""), profile->umask);
+    if(profile->charset && pos<size)
+        pos += snprintf(buf+pos, size-pos, "%scharset %s", (pos ? ", " : ""), profile->charset);
+    if(!pos)
+        snprintf(buf, size, "pmount defaults");
+}
+
+void free_profiles(ProfileSet *set)
+{
+    int i;
+
+    if(!set)
+        return;
+
+    for(i=0; i<set->n_profiles; ++i)
+        clear_profile(&set->profiles[i]);
+    free(set->profiles);
+    free(set);
+}
@@ -0,0 +1,41 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+/* Mount options for pmount, for one filesystem, one drive or one type of
+filesystem.  An option that is not set leaves pmount's default. */
+typedef struct sMountProfile
+{
+    char *key; // "uuid=...", "serial=..." or "fstype=..."
+    int sync; // -s, write through instead of async
+    int noatime; // -A
+    int read_only; // -r
+    char *umask; // -u, in octal, or NULL
+    char *charset; // -c, for vfat and similar, or NULL
+} MountProfile;
+
+/* The profiles of the profiles file, in the order they were added. */
+typedef struct sProfileSet
+{
+    MountProfile *profiles;
+    int n_profiles;
+} ProfileSet;
+
+/* Profiles loaded at startup.  Only the main thread uses them. */
+extern ProfileSet *mount_profiles;
+
+/* Arguments add_profile_args can add. */
+#define MAX_PROFILE_ARGS 7
+
+int get_profiles_filename(char *buf, int size);
+ProfileSet *load_profiles(char *filename);
+int save_profiles(ProfileSet *set, char *filename);
+int parse_profile_option(MountProfile *profile, char *option);
+MountProfile *find_profile(ProfileSet *set, char *key);
+MountProfile *match_profile(ProfileSet *set, char *uuid, char *serial, char *fs_type);
+MountProfile *set_profile(ProfileSet *set, char *key);
+void remove_profile(ProfileSet *set, char *key);
+int add_profile_args(MountProfile *profile, char **argv, int argc);
+void describe_profile(MountProfile *profile, char *buf, int size);
+void free_profiles(ProfileSet *set);
+
+#endif
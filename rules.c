@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "rules.h"
+
+/* A rules file has one rule per line: an action followed by conditions on
+udev properties, all of which must hold.  The first rule a device matches
+decides what happens to it.
+
+  # back up sticks are mounted as soon as they are plugged in
+  automount ID_BUS=usb ID_FS_LABEL=BACKUP*
+  readonly ID_SERIAL=Kingston_DataTraveler_3.0_*
+  ignore ID_FS_TYPE=ntfs
+  automount ID_BUS=usb
+
+Values are shell patterns and can't contain spaces; udev already replaces
+them with underscores in ID_FS_LABEL and ID_SERIAL. */
+
+RuleSet *automount_rules = NULL;
+
+static char *action_names[N_RULE_ACTIONS] = { "none", "automount", "readonly", "ignore" };
+
+/**
+Writes the name of a file in the configuration directory to buf.  The
+directory is in $XDG_CONFIG_HOME, or ~/.config if that is not set.  Returns 0
+on success or -1 if there is no suitable directory.
+*/
+int get_config_filename(char *name, char *buf, int size)
+{
+    char *dir;
+
+    dir = getenv("XDG_CONFIG_HOME");
+    if(dir && dir[0]=='/')
+        snprintf(buf, size, "%s/pmount-gui-ng/%s", dir, name);
+    else
+    {
+        dir = getenv("HOME");
+        if(!dir || !dir[0])
+            return -1;
+        snprintf(buf, size, "%s/.config/pmount-gui-ng/%s", dir, name);
+    }
+
+    return 0;
+}
+
+int get_rules_filename(char *buf, int size)
+{
+    return get_config_filename("rules", buf, size);
+}
+
+char *rule_action_name(RuleAction action)
+{
+    return action_names[action];
+}
+
+/**
+Parses a condition of the form NAME=pattern or NAME!=pattern and picks the
+cheapest way to compare it.  Returns 0 on success or -1 if the condition is
+not valid.
+*/
+static int compile_condition(char *str, RuleCondition *cond)
+{
+    char *equals;
+    char *pattern;
+    int len;
+
+    memset(cond, 0, sizeof(RuleCondition));
+    equals = strchr(str, '=');
+    if(!equals || equals==str || (equals==str+1 && str[0]=='!'))
+        return -1;
+    if(equals[-1]=='!')
+    {
+        cond->negate = 1;
+        equals[-1] = 0;
+    }
+    *equals = 0;
+    pattern = equals+1;
+    len = strlen(pattern);
+
+    cond->name = strdup(str);
+    cond->atom = property_atom(cond->name);
+
+    if(!strcmp(pattern, "*"))
+        cond->kind = MATCH_PRESENT;
+    else if(!strpbrk(pattern, "*?[\\"))
+        cond->kind = MATCH_EXACT;
+    else if(len>1 && pattern[len-1]=='*' && !strpbrk(pattern, "?[\\") && strchr(pattern, '*')==pattern+len-1)
+    {
+        cond->kind = MATCH_PREFIX;
+        pattern[--len] = 0;
+    }
+    else if(len>1 && pattern[0]=='*' && !strpbrk(pattern+1, "*?[\\"))
+    {
+        cond->kind = MATCH_SUFFIX;
+        ++pattern;
+        --len;
+    }
+    else
+        cond->kind = MATCH_GLOB;
+
+    cond->pattern = strdup(pattern);
+    cond->pattern_len = len;
+
+    return 0;
+}
+
+/**
+Adds a rule for a line of the rules file.  Returns 0 on success or -1 if the
+line is not a valid rule.
+*/
+static int compile_rule(RuleSet *set, char *line, int lineno, char *filename)
+{
+    char *saveptr;
+    char *word;
+    Rule rule;
+    int i;
+
+    memset(&rule, 0, sizeof(Rule));
+    rule.line = lineno;
+
+    word = strtok_r(line, " \t", &saveptr);
+    for(i=ACTION_AUTOMOUNT; i<N_RULE_ACTIONS; ++i)
+        if(!strcmp(word, action_names[i]))
+            rule.action = i;
+    if(rule.action==ACTION_NONE)
+    {
+        fprintf(stderr, "%s:%d: unknown action %s\n", filename, lineno, word);
+        return -1;
+    }
+
+    while((word = strtok_r(NULL, " \t", &saveptr)))
+    {
+        rule.conditions = (RuleCondition *)realloc(rule.conditions, (rule.n_conditions+1)*sizeof(RuleCondition));
+        if(compile_condition(word, &rule.conditions[rule.n_conditions])<0)
+        {
+            fprintf(stderr, "%s:%d: invalid condition %s\n", filename, lineno, word);
+            for(i=0; i<rule.n_conditions; ++i)
+            {
+                free(rule.conditions[i].name);
+                free(rule.conditions[i].pattern);
+            }
+            free(rule.conditions);
+            return -1;
+        }
+        ++rule.n_conditions;
+    }
+
+    set->rules = (Rule *)realloc(set->rules, (set->n_rules+1)*sizeof(Rule));
+    set->rules[set->n_rules++] = rule;
+
+    return 0;
+}
+
+/**
+Reads a rules file and compiles its rules.  Invalid lines are reported and
+skipped.  Returns NULL if the file can't be read.
+*/
+RuleSet *load_rules(char *filename)
+{
+    RuleSet *set;
+    struct stat st;
+    char *buf;
+    char *line;
+    char *end;
+    int lineno = 0;
+    int size;
+
+    buf = read_small_file(filename, &size);
+    if(!buf)
+        return NULL;
+
+    set = (RuleSet *)calloc(1, sizeof(RuleSet));
+    if(stat(filename, &st)==0)
+        set->time = st.st_mtime;
+
+    for(line=buf; *line; line=end)
+    {
+        char *ptr;
+
+        ++lineno;
+        end = strchr(line, '\n');
+        if(end)
+            *end++ = 0;
+        else
+            end = line+strlen(line);
+
+        for(ptr=line; (*ptr==' ' || *ptr=='\t'); ++ptr) ;
+        if(!*ptr || *ptr=='#')
+            continue;
+        compile_rule(set, ptr, lineno, filename);
+    }
+    free(buf);
+
+    if(verbosity>=1)
+        printf("Read %d automount rules from %s\n", set->n_rules, filename);
+
+    return set;
+}
+
+/**
+Checks one condition against a device's properties.
+*/
+static int match_condition(RuleCondition *cond, PropertySet *props)
+{
+    char *value;
+    int matched;
+    int len;
+
+    value = (cond->atom!=P_NONE ? get_atom_value(props, cond->atom) : get_property_value(props, cond->name));
+    if(!value)
+        return cond->negate;
+
+    switch(cond->kind)
+    {
+    case MATCH_EXACT:
+        matched = !strcmp(value, cond->pattern);
+        break;
+    case MATCH_PREFIX:
+        matched = !strncmp(value, cond->pattern, cond->pattern_len);
+        break;
+    case MATCH_SUFFIX:
+        len = strlen(value);
+        matched = (len>=cond->pattern_len && !strcmp(value+len-cond->pattern_len, cond->pattern));
+        break;
+    case MATCH_PRESENT:
+        matched = 1;
+        break;
+    default:
+        matched = !fnmatch(cond->pattern, value, 0);
+        break;
+    }
+
+    return matched!=cond->negate;
+}
+
+/**
+Finds the first rule that a device matches.  Returns NULL if none does.
+*/
+Rule *match_rules(RuleSet *set, PropertySet *props)
+{
+    int i;
+    int j;
+
+    if(!set)
+        return NULL;
+
+    for(i=0; i<set->n_rules; ++i)
+    {
+        Rule *rule = &set->rules[i];
+
+        for(j=0; j<rule->n_conditions; ++j)
+            if(!match_condition(&rule->conditions[j], props))
+                break;
+        if(j==rule->n_conditions)
+            return rule;
+    }
+
+    return NULL;
+}
+
+void free_rules(RuleSet *set)
+{
+    int i;
+    int j;
+
+    if(!set)
+        return;
+
+    for(i=0; i<set->n_rules; ++i)
+    {
+        for(j=0; j<set->rules[i].n_conditions; ++j)
+        {
+            free(set->rules[i].conditions[j].name);
+            free(set->rules[i].conditions[j].pattern);
+        }
+        free(set->rules[i].conditions);
+    }
+    free(set->rules);
+    free(set);
+}
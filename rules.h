@@ -0,0 +1,66 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <time.h>
+#include "udev.h"
+
+/* What to do with a device when it is plugged in. */
+typedef enum
+{
+    ACTION_NONE, // no rule matched
+    ACTION_AUTOMOUNT,
+    ACTION_READ_ONLY, // automount with pmount -r, and mount read-only by hand too
+    ACTION_IGNORE, // leave it alone, whatever later rules say
+    N_RULE_ACTIONS
+} RuleAction;
+
+/* How a condition's value is compared, chosen when the rules are loaded so that
+most conditions need a single comparison. */
+typedef enum
+{
+    MATCH_EXACT,
+    MATCH_PREFIX, // "abc*"
+    MATCH_SUFFIX, // "*abc"
+    MATCH_PRESENT, // "*"
+    MATCH_GLOB // anything else, with fnmatch
+} MatchKind;
+
+/* A condition on a udev property, e.g. ID_FS_LABEL=BACKUP*. */
+typedef struct sRuleCondition
+{
+    int atom; // PropertyAtom of the name, or P_NONE to look it up by name
+    char *name;
+    char *pattern; // without the * for prefix and suffix matches
+    int pattern_len;
+    MatchKind kind;
+    int negate; // written with != instead of =
+} RuleCondition;
+
+typedef struct sRule
+{
+    RuleAction action;
+    RuleCondition *conditions;
+    int n_conditions;
+    int line; // in the rules file
+} Rule;
+
+/* The rules of a rules file, in order.  A set never changes once loaded, so
+scan threads can read it without locking. */
+typedef struct sRuleSet
+{
+    Rule *rules;
+    int n_rules;
+    time_t time; // mtime of the file
+} RuleSet;
+
+/* Rules loaded at startup, or NULL if there are none. */
+extern RuleSet *automount_rules;
+
+int get_config_filename(char *name, char *buf, int size);
+int get_rules_filename(char *buf, int size);
+RuleSet *load_rules(char *filename);
+Rule *match_rules(RuleSet *set, PropertySet *props);
+char *rule_action_name(RuleAction action);
+void free_rules(RuleSet *set);
+
+#endif
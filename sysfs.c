@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/sysmacros.h>
+#include "udev.h"
+#include "sysfs.h"
+
+#define SUBSYSTEM_UNKNOWN ((char *)-1)
+#define REMOVABLE_UNKNOWN -2
+
+/* A directory under /sys, identified by its path relative to /sys.  Its
+subsystem and removable attribute are read when first needed. */
+struct sSysfsNode
+{
+    SysfsNode *next;
+    char *path;
+    int path_len;
+    unsigned hash;
+    char *subsystem;
+    int removable;
+};
+
+/**
+Hashes the first len characters of a path.
+*/
+static unsigned hash_path(char *path, int len)
+{
+    unsigned h = 2166136261u;
+    int i;
+    for(i=0; i<len; ++i)
+        h = (h^(unsigned char)path[i])*16777619u;
+    return h;
+}
+
+/**
+Creates an empty cache.  All lookups are made relative to the /sys directory,
+which is opened once here.  Returns NULL if sysfs is not available.
+*/
+SysfsCache *new_sysfs_cache(void)
+{
+    SysfsCache *cache;
+    char fnbuf[1100];
+    int fd;
+
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    fd = open(fnbuf, O_PATH|O_DIRECTORY|O_CLOEXEC);
+    if(fd==-1)
+        return NULL;
+
+    cache = (SysfsCache *)calloc(1, sizeof(SysfsCache));
+    cache->root_fd = fd;
+    cache->n_slots = 64;
+    cache->slots = (SysfsNode **)calloc(cache->n_slots, sizeof(SysfsNode *));
+
+    return cache;
+}
+
+/**
+Doubles the number of hash slots in a cache.
+*/
+static void grow_cache(SysfsCache *cache)
+{
+    SysfsNode **slots;
+    int n_slots = cache->n_slots*2;
+    int i;
+
+    slots = (SysfsNode **)calloc(n_slots, sizeof(SysfsNode *));
+    for(i=0; i<cache->n_slots; ++i)
+    {
+        SysfsNode *node;
+        SysfsNode *next;
+        for(node=cache->slots[i]; node; node=next)
+        {
+            next = node->next;
+            node->next = slots[node->hash&(n_slots-1)];
+            slots[node->hash&(n_slots-1)] = node;
+        }
+    }
+
+    free(cache->slots);
+    cache->slots = slots;
+    cache->n_slots = n_slots;
+}
+
+/**
+Finds the node for a directory given as the first len characters of a path
+relative to /sys, adding it if it's not in the cache yet.
+*/
+static SysfsNode *get_node(SysfsCache *cache, char *path, int len)
+{
+    unsigned hash = hash_path(path, len);
+    SysfsNode *node;
+
+    for(node=cache->slots[hash&(cache->n_slots-1)]; node; node=node->next)
+        if(node->hash==hash && node->path_len==len && !memcmp(node->path, path, len))
+            return node;
+
+    if(cache->n_nodes>=cache->n_slots)
+        grow_cache(cache);
+
+    node = (SysfsNode *)calloc(1, sizeof(SysfsNode));
+    node->path = (char *)malloc(len+1);
+    memcpy(node->path, path, len);
+    node->path[len] = 0;
+    node->path_len = len;
+    node->hash = hash;
+    node->subsystem = SUBSYSTEM_UNKNOWN;
+    node->removable = REMOVABLE_UNKNOWN;
+    node->next = cache->slots[hash&(cache->n_slots-1)];
+    cache->slots[hash&(cache->n_slots-1)] = node;
+    ++cache->n_nodes;
+
+    return node;
+}
+
+/**
+Opens a node's directory for use as a base for relative lookups.
+*/
+static int open_node(SysfsCache *cache, SysfsNode *node)
+{
+    /* Skip the leading slash to make the path relative to /sys. */
+    return openat(cache->root_fd, node->path+1, O_PATH|O_DIRECTORY|O_CLOEXEC);
+}
+
+/**
+Returns the name of the subsystem a directory belongs to, or NULL if it has
+none.
+*/
+static char *get_subsystem(SysfsCache *cache, SysfsNode *node)
+{
+    char linkbuf[1024];
+    int fd;
+    int len;
+
+    if(node->subsystem!=SUBSYSTEM_UNKNOWN)
+        return node->subsystem;
+
+    node->subsystem = NULL;
+    fd = open_node(cache, node);
+    if(fd==-1)
+        return NULL;
+
+    len = readlinkat(fd, "subsystem", linkbuf, sizeof(linkbuf)-1);
+    close(fd);
+    if(len!=-1)
+    {
+        linkbuf[len] = 0;
+        /* Extract the last component of the subsystem symlink. */
+        for(; (len>0 && linkbuf[len-1]!='/'); --len) ;
+        node->subsystem = strdup(linkbuf+len);
+
+        if(verbosity>=2)
+            printf("  Subsystem of /sys%s is %s\n", node->path, node->subsystem);
+    }
+
+    return node->subsystem;
+}
+
+/**
+Returns the value of a directory's removable attribute: 1 or 0, or -1 if it
+doesn't have one.
+*/
+static int get_removable(SysfsCache *cache, SysfsNode *node)
+{
+    int dir_fd;
+    int fd;
+    char c;
+
+    if(node->removable!=REMOVABLE_UNKNOWN)
+        return node->removable;
+
+    node->removable = -1;
+    dir_fd = open_node(cache, node);
+    if(dir_fd==-1)
+        return -1;
+
+    fd = openat(dir_fd, "removable", O_RDONLY|O_CLOEXEC);
+    close(dir_fd);
+    if(fd!=-1)
+    {
+        if(read(fd, &c, 1)==1)
+            node->removable = (c=='1');
+        close(fd);
+    }
+
+    return node->removable;
+}
+
+/**
+Returns the length of the parent directory of the first len characters of a
+path, or 0 if there is no parent.
+*/
+static int parent_len(char *path, int len)
+{
+    for(--len; (len>0 && path[len]!='/'); --len) ;
+    return len;
+}
+
+/**
+Checks if a partition identified by a sysfs path is on a removable device.
+*/
+int is_removable(SysfsCache *cache, char *devpath)
+{
+    int len;
+
+    if(!cache || !devpath)
+        return 0;
+
+    /* We got a partition as a parameter, but the removable property is on the
+    disk. */
+    len = parent_len(devpath, strlen(devpath));
+    if(!len)
+        return 0;
+
+    if(get_removable(cache, get_node(cache, devpath, len))==1)
+    {
+        if(verbosity>=2)
+            printf("  Removable\n");
+        return 1;
+    }
+
+    if(verbosity>=2)
+        printf("  Not removable\n");
+    return 0;
+}
+
+/**
+Checks if a partition's disk or any of its parent devices are connected to any
+of a set of buses.  The device is identified by a sysfs path.  The bus array
+must be terminated with a NULL entry.
+*/
+int check_buses(SysfsCache *cache, char *devpath, char **buses)
+{
+    int len;
+
+    if(!cache || !devpath)
+        return 0;
+
+    /* Walk up from the disk, stopping below /devices. */
+    for(len=parent_len(devpath, strlen(devpath)); len>8; len=parent_len(devpath, len))
+    {
+        char *subsystem;
+        int i;
+
+        subsystem = get_subsystem(cache, get_node(cache, devpath, len));
+        if(!subsystem)
+            continue;
+
+        for(i=0; buses[i]; ++i)
+            if(!strcmp(subsystem, buses[i]))
+                return 1;
+    }
+
+    return 0;
+}
+
+/**
+Frees a cache and everything in it.
+*/
+void free_sysfs_cache(SysfsCache *cache)
+{
+    int i;
+
+    if(!cache)
+        return;
+
+    for(i=0; i<cache->n_slots; ++i)
+    {
+        SysfsNode *node;
+        SysfsNode *next;
+        for(node=cache->slots[i]; node; node=next)
+        {
+            next = node->next;
+            if(node->subsystem!=SUBSYSTEM_UNKNOWN)
+                free(node->subsystem);
+            free(node->path);
+            free(node);
+        }
+    }
+
+    close(cache->root_fd);
+    free(cache->slots);
+    free(cache);
+}
+
+/**
+Reads a small attribute file relative to a directory, without the trailing
+newline.  Returns its length, or -1 if it could not be read.
+*/
+static int read_attr(int dir_fd, char *name, char *buf, int size)
+{
+    int fd;
+    int len;
+
+    fd = openat(dir_fd, name, O_RDONLY|O_CLOEXEC);
+    if(fd==-1)
+        return -1;
+    len = read(fd, buf, size-1);
+    close(fd);
+    if(len<0)
+        return -1;
+
+    while(len>0 && buf[len-1]=='\n')
+        --len;
+    buf[len] = 0;
+
+    return len;
+}
+
+/**
+Hashes a device number for the set of devices already listed.
+*/
+static unsigned hash_devnum(dev_t devnum)
+{
+    unsigned long long h = (unsigned long long)devnum*0x9E3779B97F4A7C15ULL;
+    return (unsigned)(h>>32);
+}
+
+/**
+Adds a device number to an open-addressing set, growing it when it gets half
+full.  Returns 0 if the number was already in the set.
+*/
+static int add_devnum(dev_t **slots, int *n_slots, int *n_used, dev_t devnum)
+{
+    unsigned mask;
+    unsigned slot;
+
+    if(*n_used*2>=*n_slots)
+    {
+        dev_t *old = *slots;
+        int n_old = *n_slots;
+        int i;
+
+        *n_slots = (n_old ? n_old*2 : 64);
+        *slots = (dev_t *)calloc(*n_slots, sizeof(dev_t));
+        *n_used = 0;
+        for(i=0; i<n_old; ++i)
+            if(old[i])
+                add_devnum(slots, n_slots, n_used, old[i]);
+        free(old);
+    }
+
+    mask = *n_slots-1;
+    for(slot=hash_devnum(devnum)&mask; (*slots)[slot]; slot=(slot+1)&mask)
+        if((*slots)[slot]==devnum)
+            return 0;
+    (*slots)[slot] = devnum;
+    ++*n_used;
+
+    return 1;
+}
+
+/**
+Lists the block devices in /sys/class/block, reading each one's attributes
+relative to its directory.  A device number that shows up under more than one
+name is listed once.  Returns an array of count devices, or NULL if there are
+none or sysfs is not available.
+*/
+BlockDevice *list_block_devices(int *count)
+{
+    char fnbuf[1100];
+    int root_fd;
+    int class_fd;
+    DIR *dir;
+    struct dirent *de;
+    BlockDevice *devices = NULL;
+    int n_devices = 0;
+    int n_alloc = 0;
+    dev_t *seen = NULL;
+    int n_seen_slots = 0;
+    int n_seen = 0;
+
+    *count = 0;
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    root_fd = open(fnbuf, O_PATH|O_DIRECTORY|O_CLOEXEC);
+    if(root_fd==-1)
+        return NULL;
+    class_fd = openat(root_fd, "class/block", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    close(root_fd);
+    if(class_fd==-1)
+        return NULL;
+    dir = fdopendir(class_fd);
+    if(!dir)
+    {
+        close(class_fd);
+        return NULL;
+    }
+
+    while((de = readdir(dir)))
+    {
+        char buf[64];
+        unsigned maj;
+        unsigned min;
+        int dev_fd;
+        BlockDevice *bd;
+
+        if(de->d_name[0]=='.')
+            continue;
+
+        /* The entries are symlinks into /sys/devices; the attributes are read
+        through a descriptor of where they point. */
+        dev_fd = openat(class_fd, de->d_name, O_PATH|O_DIRECTORY|O_CLOEXEC);
+        if(dev_fd==-1)
+            continue;
+        if(read_attr(dev_fd, "dev", buf, sizeof(buf))<0 || sscanf(buf, "%u:%u", &maj, &min)!=2
+            || !add_devnum(&seen, &n_seen_slots, &n_seen, makedev(maj, min)))
+        {
+            close(dev_fd);
+            continue;
+        }
+
+        if(n_devices==n_alloc)
+        {
+            n_alloc = (n_alloc ? n_alloc*2 : 16);
+            devices = (BlockDevice *)realloc(devices, n_alloc*sizeof(BlockDevice));
+        }
+        bd = &devices[n_devices++];
+        bd->name = strdup(de->d_name);
+        bd->devnum = makedev(maj, min);
+        bd->size = (read_attr(dev_fd, "size", buf, sizeof(buf))>0 ? strtoull(buf, NULL, 10) : 0);
+        close(dev_fd);
+
+        if(verbosity>=2)
+            printf("Block device %s (%u:%u) size %llu\n", bd->name, maj, min, bd->size);
+    }
+
+    closedir(dir);
+    free(seen);
+
+    *count = n_devices;
+    return devices;
+}
+
+/**
+Frees an array of block devices.
+*/
+void free_block_devices(BlockDevice *devices, int count)
+{
+    int i;
+
+    for(i=0; i<count; ++i)
+        free(devices[i].name);
+    free(devices);
+}
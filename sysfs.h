@@ -0,0 +1,34 @@
+#ifndef SYSFS_H
+#define SYSFS_H
+
+#include <sys/types.h>
+
+typedef struct sSysfsNode SysfsNode;
+
+/* Remembers what has been looked up about directories under /sys/devices
+during an enumeration.  Partitions of the same disk and disks behind the same
+hub share ancestors, which are then only examined once. */
+typedef struct sSysfsCache
+{
+    int root_fd;
+    SysfsNode **slots;
+    int n_slots;
+    int n_nodes;
+} SysfsCache;
+
+/* A block device found in /sys/class/block. */
+typedef struct sBlockDevice
+{
+    char *name; // e.g. sdb1
+    dev_t devnum;
+    unsigned long long size; // in 512-byte sectors, 0 without a medium
+} BlockDevice;
+
+SysfsCache *new_sysfs_cache(void);
+void free_sysfs_cache(SysfsCache *cache);
+int is_removable(SysfsCache *cache, char *devpath);
+int check_buses(SysfsCache *cache, char *devpath, char **buses);
+BlockDevice *list_block_devices(int *count);
+void free_block_devices(BlockDevice *devices, int count);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+/* Number of calls to malloc, calloc and realloc so far, including those made
+inside the C library. */
+unsigned long get_alloc_count(void);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../devices.h"
+#include "alloc.h"
+#include "fixture.h"
+
+/* Measures the stages of an enumeration on generated fixtures of several
+sizes, and prints latency percentiles and allocations per call for each.
+
+Usage: bench [-n iterations] [size...]
+The default sizes are 10, 1000 and 10000 devices, the largest with at most 5
+iterations. */
+
+/* Latencies of the runs of one stage. */
+typedef struct sSamples
+{
+    double *times;
+    int count;
+    unsigned long allocs;
+} Samples;
+
+typedef void (*StageFunc)(void *data);
+
+/* A stage run once per node rather than once per enumeration. */
+typedef struct sNodeStage
+{
+    char **nodes;
+} NodeStage;
+
+enum { BY_ID, EXPORT_DB, CLASS_BLOCK };
+
+static char by_id_dir[1024];
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    double ta = *(double *)a;
+    double tb = *(double *)b;
+    return (ta<tb ? -1 : ta>tb);
+}
+
+static void set_method(int method)
+{
+    use_sysfs_enumeration = (method==CLASS_BLOCK);
+    use_export_db = (method==EXPORT_DB);
+    mount_state_loaded = 0;
+}
+
+static void run_device_nodes(void *data)
+{
+    free_device_names(get_device_nodes(by_id_dir));
+}
+
+static void run_block_nodes(void *data)
+{
+    free_device_names(get_block_nodes());
+}
+
+static void run_properties(void *data)
+{
+    NodeStage *stage = data;
+    int i;
+
+    for(i=0; stage->nodes[i]; ++i)
+        free_properties(get_device_properties(stage->nodes[i]));
+}
+
+static void run_can_mount(void *data)
+{
+    NodeStage *stage = data;
+    SysfsCache *sysfs = new_sysfs_cache();
+    int i;
+
+    for(i=0; stage->nodes[i]; ++i)
+    {
+        PropertySet *props = get_device_properties(stage->nodes[i]);
+        if(props)
+        {
+            can_mount(props, fstab_set, sysfs);
+            free_properties(props);
+        }
+    }
+    free_sysfs_cache(sysfs);
+}
+
+static void run_get_devices(void *data)
+{
+    set_method(*(int *)data);
+    free_devices(get_devices());
+}
+
+/**
+Runs a stage a number of times, after one run to warm the page cache.
+*/
+static void measure(StageFunc func, void *data, int iterations, Samples *samples)
+{
+    unsigned long start_allocs;
+    int i;
+
+    func(data);
+    samples->times = malloc(iterations*sizeof(double));
+    samples->count = iterations;
+    start_allocs = get_alloc_count();
+    for(i=0; i<iterations; ++i)
+    {
+        double start = get_time_ms();
+        func(data);
+        samples->times[i] = get_time_ms()-start;
+    }
+    samples->allocs = (get_alloc_count()-start_allocs)/iterations;
+    qsort(samples->times, iterations, sizeof(double), &compare_times);
+}
+
+static double percentile(Samples *samples, int p)
+{
+    int i = (samples->count*p+99)/100-1;
+    return samples->times[(i<0 ? 0 : i)];
+}
+
+static void report(char *name, int size, Samples *samples, int per)
+{
+    printf("%-24s %6d %10.3f %10.3f %10.3f %10.3f %10lu", name, size, percentile(samples, 50), percentile(samples, 90),
+        percentile(samples, 99), samples->times[samples->count-1], samples->allocs);
+    if(per>0)
+        printf(" %8.1f", (double)samples->allocs/per);
+    putchar('\n');
+    free(samples->times);
+}
+
+static int bench_size(int size, int iterations)
+{
+    char dir[64];
+    FixtureInfo info;
+    NodeStage stage;
+    Samples samples;
+    int method;
+
+    snprintf(dir, sizeof(dir), "/tmp/pmount-gui-ng-bench.XXXXXX");
+    if(!mkdtemp(dir) || make_fixture(dir, size, &info)<0)
+    {
+        fprintf(stderr, "can't generate a fixture of %d devices in %s\n", size, dir);
+        return -1;
+    }
+    snprintf(sysroot, sizeof(sysroot), "%s", dir);
+    snprintf(export_db_file, sizeof(export_db_file), "%s/export-db", dir);
+    snprintf(by_id_dir, sizeof(by_id_dir), "%s/dev/disk/by-id", dir);
+    set_method(BY_ID);
+    load_mount_state();
+
+    measure(&run_device_nodes, NULL, iterations, &samples);
+    report("get_device_nodes", size, &samples, 2*size);
+    measure(&run_block_nodes, NULL, iterations, &samples);
+    report("get_block_nodes", size, &samples, 2*size);
+
+    stage.nodes = get_device_nodes(by_id_dir);
+    if(stage.nodes)
+    {
+        measure(&run_properties, &stage, iterations, &samples);
+        report("get_device_properties", size, &samples, 2*size);
+        measure(&run_can_mount, &stage, iterations, &samples);
+        report("can_mount", size, &samples, 2*size);
+        free_device_names(stage.nodes);
+    }
+
+    for(method=BY_ID; method<=CLASS_BLOCK; ++method)
+    {
+        static char *names[] = { "get_devices", "get_devices export-db", "get_devices class/block" };
+        measure(&run_get_devices, &method, iterations, &samples);
+        report(names[method], size, &samples, info.n_mountable);
+    }
+
+    remove_fixture(dir);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static int default_sizes[] = { 10, 1000, 10000 };
+    int iterations = 20;
+    int opt;
+    int i;
+
+    while((opt = getopt(argc, argv, "n:"))!=-1)
+    {
+        if(opt=='n' && atoi(optarg)>0)
+            iterations = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n iterations] [size...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    set_child_timeouts("udevadm=2");
+
+    printf("%-24s %6s %10s %10s %10s %10s %10s %8s\n", "stage", "disks", "p50 ms", "p90 ms", "p99 ms", "max ms", "allocs", "per dev");
+    if(optind<argc)
+    {
+        for(i=optind; i<argc; ++i)
+            if(atoi(argv[i])>0 && bench_size(atoi(argv[i]), iterations)<0)
+                return 1;
+    }
+    else
+    {
+        for(i=0; i<(int)(sizeof(default_sizes)/sizeof(int)); ++i)
+            if(bench_size(default_sizes[i], (default_sizes[i]>=10000 && iterations>5 ? 5 : iterations))<0)
+                return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../udev.h"
+#include "alloc.h"
+#include "fixture.h"
+
+/* Measures the line reader and parse_property on generated udevadm output of
+several sizes, read in pipe-sized and in small chunks.
+
+Usage: bench_parse [-n iterations] [lines...]
+The default sizes are 30 lines (one device), 1000 and 100000 lines. */
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    double ta = *(double *)a;
+    double tb = *(double *)b;
+    return (ta<tb ? -1 : ta>tb);
+}
+
+/**
+Generates count lines of output like udevadm info -q property, with a long
+DEVLINKS line and an occasional malformed line.
+*/
+static char *make_output(int count, int *size)
+{
+    char *text = (char *)malloc(count*200+1);
+    int len = 0;
+    int i;
+
+    for(i=0; i<count; ++i)
+    {
+        switch(i%6)
+        {
+        case 0:
+            len += sprintf(text+len, "DEVNAME=/dev/sd%c%d\n", 'a'+i%26, i%16);
+            break;
+        case 1:
+            len += sprintf(text+len, "DEVLINKS=/dev/disk/by-id/usb-Vendor_Model_%08d-0:0-part1 /dev/disk/by-uuid/%04X-%04X"
+                " /dev/disk/by-path/pci-0000:00:14.0-usb-0:%d:1.0-scsi-0:0:0:0-part1\n", i, i>>16, i&0xffff, i%8);
+            break;
+        case 2:
+            len += sprintf(text+len, "ID_FS_UUID=%04X-%04X\n", i>>16, i&0xffff);
+            break;
+        case 3:
+            len += sprintf(text+len, (i%60==3 ? "malformed line %d\n" : "ID_MODEL=Model_%d\n"), i);
+            break;
+        default:
+            len += sprintf(text+len, "ID_PROPERTY_%d=value %d\n", i, i);
+            break;
+        }
+    }
+    *size = len;
+
+    return text;
+}
+
+static void bench_lines(int count, int chunk, int iterations)
+{
+    char buf[PROPERTY_LINE_MAX];
+    double *times = (double *)malloc(iterations*sizeof(double));
+    unsigned long allocs = 0;
+    int size;
+    char *text = make_output(count, &size);
+    int i;
+
+    for(i=-1; i<iterations; ++i)
+    {
+        MemoryStream stream = { text, size, 0, chunk };
+        LineReader reader;
+        unsigned long start_allocs = get_alloc_count();
+        double start = get_time_ms();
+        PropertySet *set = new_properties();
+
+        init_line_reader(&reader, buf, sizeof(buf), &read_memory, &stream);
+        add_property_lines(set, &reader);
+        free_properties(set);
+        if(i>=0)
+        {
+            times[i] = get_time_ms()-start;
+            allocs += get_alloc_count()-start_allocs;
+        }
+    }
+    qsort(times, iterations, sizeof(double), &compare_times);
+
+    printf("%8d %8d %6d %10.4f %10.4f %10.4f %9.1f %9lu\n", count, size, chunk, times[iterations/2],
+        times[(iterations*99+99)/100-1], times[iterations-1], times[iterations/2]*1000000.0/count, allocs/iterations);
+
+    free(times);
+    free(text);
+}
+
+int main(int argc, char **argv)
+{
+    static int default_sizes[] = { 30, 1000, 100000 };
+    static int chunks[] = { 4096, 64 };
+    int iterations = 50;
+    int opt;
+    int i;
+    int c;
+
+    while((opt = getopt(argc, argv, "n:"))!=-1)
+    {
+        if(opt=='n' && atoi(optarg)>0)
+            iterations = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n iterations] [lines...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%8s %8s %6s %10s %10s %10s %9s %9s\n", "lines", "bytes", "read", "p50 ms", "p99 ms", "max ms", "ns/line", "allocs");
+    for(c=0; c<(int)(sizeof(chunks)/sizeof(int)); ++c)
+    {
+        if(optind<argc)
+        {
+            for(i=optind; i<argc; ++i)
+                if(atoi(argv[i])>0)
+                    bench_lines(atoi(argv[i]), chunks[c], iterations);
+        }
+        else
+        {
+            for(i=0; i<(int)(sizeof(default_sizes)/sizeof(int)); ++i)
+                bench_lines(default_sizes[i], chunks[c], iterations);
+        }
+    }
+
+    return 0;
+}
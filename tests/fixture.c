@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "fixture.h"
+
+/* Generates a tree that looks like /dev, /sys, /run/udev, /proc and /etc of a
+machine with many disks, for running the enumeration with -R.  Every disk has
+a single partition.  Disks come in four kinds, by index modulo 4:
+
+  0, 1  USB sticks: removable, with ID_BUS=usb
+  2     card readers on USB: not removable and without ID_BUS, so only the
+        walk up sysfs to the usb bus finds them
+  3     internal ATA disks: not mountable, except that every other one has a
+        user entry in fstab by UUID
+
+Every tenth disk's partition is mounted.  An export-db dump of the udev
+database is written to export-db. */
+
+#define KIND_STICK(i) ((i)%4<2)
+#define KIND_READER(i) ((i)%4==2)
+#define KIND_ATA(i) ((i)%4==3)
+#define IN_FSTAB(i) ((i)%8==3)
+#define MOUNTED(i) (!KIND_ATA(i) && (i)%10==0)
+
+/**
+Writes the udev name of the index'th disk, e.g. sda, sdz, sdaa.
+*/
+void fixture_disk_name(int index, char *buf, int size)
+{
+    char letters[8];
+    int len = 0;
+    int i;
+
+    for(++index; (index>0 && len<(int)sizeof(letters)); index=(index-1)/26)
+        letters[len++] = 'a'+(index-1)%26;
+
+    if(size<3)
+        return;
+    buf[0] = 's';
+    buf[1] = 'd';
+    for(i=0; (i<len && i+3<size); ++i)
+        buf[2+i] = letters[len-1-i];
+    buf[2+i] = 0;
+}
+
+/**
+Creates a file with formatted contents.
+*/
+static int write_file(char *path, char *fmt, ...)
+{
+    va_list args;
+    FILE *file;
+
+    file = fopen(path, "w");
+    if(!file)
+        return -1;
+    va_start(args, fmt);
+    vfprintf(file, fmt, args);
+    va_end(args);
+
+    return fclose(file);
+}
+
+/**
+Creates a directory and its parents.
+*/
+static int make_dirs(char *path)
+{
+    char buf[1024];
+    char *ptr;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for(ptr=buf+1; *ptr; ++ptr)
+        if(*ptr=='/')
+        {
+            *ptr = 0;
+            mkdir(buf, 0755);
+            *ptr = '/';
+        }
+
+    return (mkdir(buf, 0755)<0 && access(buf, F_OK)<0 ? -1 : 0);
+}
+
+static int make_link(char *target, char *fmt, ...)
+{
+    char path[1024];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(path, sizeof(path), fmt, args);
+    va_end(args);
+
+    return symlink(target, path);
+}
+
+/**
+Generates a fixture with count disks in dir, which must not exist yet, and
+describes what enumerating it should find.  Returns 0 on success or -1 on
+failure.
+*/
+int make_fixture(char *dir, int count, FixtureInfo *info)
+{
+    static char *subdirs[] = { "dev/disk/by-id", "sys/class/block", "sys/dev/block", "sys/bus/usb",
+        "sys/bus/ata", "sys/devices/pci0/usb1", "sys/devices/pci0/ata1", "run/udev/data", "proc/self", "etc", NULL };
+    char path[1024];
+    FILE *db;
+    FILE *fstab;
+    FILE *mountinfo;
+    int i;
+
+    memset(info, 0, sizeof(FixtureInfo));
+    for(i=0; subdirs[i]; ++i)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, subdirs[i]);
+        if(make_dirs(path)<0)
+            return -1;
+    }
+    make_link("../../../bus/usb", "%s/sys/devices/pci0/usb1/subsystem", dir);
+    make_link("../../../bus/ata", "%s/sys/devices/pci0/ata1/subsystem", dir);
+
+    snprintf(path, sizeof(path), "%s/export-db", dir);
+    db = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/etc/fstab", dir);
+    fstab = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/proc/self/mountinfo", dir);
+    mountinfo = fopen(path, "w");
+    if(!db || !fstab || !mountinfo)
+    {
+        if(db)
+            fclose(db);
+        if(fstab)
+            fclose(fstab);
+        if(mountinfo)
+            fclose(mountinfo);
+        return -1;
+    }
+    fprintf(fstab, "# generated fixture\n/dev/root / ext4 defaults 0 1\n");
+    fprintf(mountinfo, "25 1 0:22 / / rw - tmpfs tmpfs rw\n");
+
+    for(i=0; i<count; ++i)
+    {
+        char disk[16];
+        char part[20];
+        char devpath[256];
+        char linkname[128];
+        char uuid[16];
+        char *bus = (KIND_ATA(i) ? "ata" : "usb");
+        int minor = i*16;
+        int p;
+
+        fixture_disk_name(i, disk, sizeof(disk));
+        snprintf(part, sizeof(part), "%s1", disk);
+        snprintf(uuid, sizeof(uuid), "%04X-%04X", (i>>16)&0xffff, i&0xffff);
+        if(KIND_ATA(i))
+        {
+            snprintf(devpath, sizeof(devpath), "/devices/pci0/ata1/host%d/target%d:0:0/block/%s", i, i, disk);
+            snprintf(linkname, sizeof(linkname), "ata-Fixture_Disk_%d", i);
+        }
+        else
+        {
+            snprintf(devpath, sizeof(devpath), "/devices/pci0/usb1/1-%d/host%d/block/%s", i, i, disk);
+            snprintf(linkname, sizeof(linkname), "usb-Fixture_%s_%d-0:0", (KIND_READER(i) ? "Reader" : "Stick"), i);
+        }
+
+        /* The disk and its partition in sysfs. */
+        snprintf(path, sizeof(path), "%s/sys%s/%s", dir, devpath, part);
+        if(make_dirs(path)<0)
+            break;
+        snprintf(path, sizeof(path), "%s/sys%s/dev", dir, devpath);
+        write_file(path, "8:%d\n", minor);
+        snprintf(path, sizeof(path), "%s/sys%s/removable", dir, devpath);
+        write_file(path, "%d\n", KIND_STICK(i));
+        snprintf(path, sizeof(path), "%s/sys%s/size", dir, devpath);
+        write_file(path, "%d\n", 31260672);
+        snprintf(path, sizeof(path), "%s/sys%s/uevent", dir, devpath);
+        write_file(path, "MAJOR=8\nMINOR=%d\nDEVNAME=%s\nDEVTYPE=disk\n", minor, disk);
+        snprintf(path, sizeof(path), "%s/sys%s/%s/dev", dir, devpath, part);
+        write_file(path, "8:%d\n", minor+1);
+        snprintf(path, sizeof(path), "%s/sys%s/%s/partition", dir, devpath, part);
+        write_file(path, "1\n");
+        snprintf(path, sizeof(path), "%s/sys%s/%s/size", dir, devpath, part);
+        write_file(path, "%d\n", 31258624);
+        snprintf(path, sizeof(path), "%s/sys%s/%s/uevent", dir, devpath, part);
+        write_file(path, "MAJOR=8\nMINOR=%d\nDEVNAME=%s\nDEVTYPE=partition\nPARTN=1\n", minor+1, part);
+        snprintf(path, sizeof(path), "%s/sys%s/%s/stat", dir, devpath, part);
+        write_file(path, "%s\n", "     100        0     2048       10        0        0        0        0        0       10       10");
+
+        /* The links sysfs and udev make to it. */
+        snprintf(path, sizeof(path), "../..%s", devpath);
+        make_link(path, "%s/sys/class/block/%s", dir, disk);
+        make_link(path, "%s/sys/dev/block/8:%d", dir, minor);
+        snprintf(path, sizeof(path), "../..%s/%s", devpath, part);
+        make_link(path, "%s/sys/class/block/%s", dir, part);
+        make_link(path, "%s/sys/dev/block/8:%d", dir, minor+1);
+        snprintf(path, sizeof(path), "../../%s", disk);
+        make_link(path, "%s/dev/disk/by-id/%s", dir, linkname);
+        snprintf(path, sizeof(path), "../../%s", part);
+        make_link(path, "%s/dev/disk/by-id/%s-part1", dir, linkname);
+
+        /* The udev database, both as files and as a dump. */
+        for(p=0; p<2; ++p)
+        {
+            char *name = (p ? part : disk);
+            char props[512];
+            int len = 0;
+
+            if(!KIND_READER(i))
+                len += snprintf(props+len, sizeof(props)-len, "E:ID_BUS=%s\n", bus);
+            len += snprintf(props+len, sizeof(props)-len, "E:ID_VENDOR=Fixture\nE:ID_MODEL=%s_%d\n", (KIND_ATA(i) ? "Disk" : "Stick"), i);
+            if(p)
+                len += snprintf(props+len, sizeof(props)-len, "E:ID_FS_TYPE=vfat\nE:ID_FS_UUID=%s\nE:ID_FS_LABEL=FX%d\nE:ID_FS_LABEL_ENC=FX%d\n", uuid, i, i);
+
+            snprintf(path, sizeof(path), "%s/run/udev/data/b8:%d", dir, minor+p);
+            write_file(path, "S:disk/by-id/%s%s\n%sG:systemd\n", linkname, (p ? "-part1" : ""), props);
+
+            fprintf(db, "P: %s%s%s\nN: %s\nS: disk/by-id/%s%s\n", devpath, (p ? "/" : ""), (p ? part : ""), name, linkname, (p ? "-part1" : ""));
+            fprintf(db, "E: DEVPATH=%s%s%s\nE: SUBSYSTEM=block\nE: DEVNAME=/dev/%s\nE: DEVTYPE=%s\nE: MAJOR=8\nE: MINOR=%d\n",
+                devpath, (p ? "/" : ""), (p ? part : ""), name, (p ? "partition" : "disk"), minor+p);
+            fprintf(db, "E: DEVLINKS=/dev/disk/by-id/%s%s\n", linkname, (p ? "-part1" : ""));
+            if(!KIND_READER(i))
+                fprintf(db, "E: ID_BUS=%s\n", bus);
+            fprintf(db, "E: ID_VENDOR=Fixture\nE: ID_MODEL=%s_%d\n", (KIND_ATA(i) ? "Disk" : "Stick"), i);
+            if(p)
+                fprintf(db, "E: ID_FS_TYPE=vfat\nE: ID_FS_UUID=%s\nE: ID_FS_LABEL=FX%d\nE: ID_FS_LABEL_ENC=FX%d\n", uuid, i, i);
+            fprintf(db, "\n");
+        }
+
+        if(IN_FSTAB(i))
+            fprintf(fstab, "UUID=%s /mnt/fx%d vfat user,noauto 0 0\n", uuid, i);
+        if(MOUNTED(i))
+            fprintf(mountinfo, "%d 25 8:%d / /media/%s-FX%d rw,nosuid,nodev - vfat /dev/%s rw\n", 100+i, minor+1, part, i, part);
+
+        ++info->n_devices;
+        if(!KIND_ATA(i) || IN_FSTAB(i))
+            ++info->n_mountable;
+        if(MOUNTED(i))
+            ++info->n_mounted;
+    }
+
+    fclose(db);
+    fclose(fstab);
+    fclose(mountinfo);
+
+    return (info->n_devices==count ? 0 : -1);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+/**
+Deletes a fixture tree.
+*/
+int remove_fixture(char *dir)
+{
+    return nftw(dir, &remove_entry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+/**
+Reads from a MemoryStream, for use as a ReadFunc.
+*/
+int read_memory(void *data, char *buf, int size)
+{
+    MemoryStream *stream = (MemoryStream *)data;
+    int len = stream->size-stream->pos;
+
+    if(stream->chunk>0 && len>stream->chunk)
+        len = stream->chunk;
+    if(len>size)
+        len = size;
+    memcpy(buf, stream->data+stream->pos, len);
+    stream->pos += len;
+
+    return len;
+}
@@ -0,0 +1,27 @@
+#ifndef FIXTURE_H
+#define FIXTURE_H
+
+/* What a generated fixture should enumerate to. */
+typedef struct sFixtureInfo
+{
+    int n_devices; // disks, each with one partition
+    int n_mountable; // partitions that can_mount should accept
+    int n_mounted; // of those, partitions listed in mountinfo
+} FixtureInfo;
+
+/* A stream over a buffer in memory that hands out at most chunk bytes per
+read, to exercise readers with partial reads. */
+typedef struct sMemoryStream
+{
+    char *data;
+    int size;
+    int pos;
+    int chunk;
+} MemoryStream;
+
+int make_fixture(char *dir, int count, FixtureInfo *info);
+int remove_fixture(char *dir);
+void fixture_disk_name(int index, char *buf, int size);
+int read_memory(void *data, char *buf, int size);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "../udev.h"
+#include "fixture.h"
+
+/* Fuzz target for parse_property and the line reader.  Built with
+-fsanitize=fuzzer this is a libFuzzer target; built with -DFUZZ_REPLAY it is
+a standalone program that runs the files given as arguments, or random inputs
+if there are none, so it also works with compilers that lack libFuzzer. */
+
+/**
+Checks that a property points into the line it was parsed from and that its
+name has no equals sign.
+*/
+static void check_property(Property *prop, char *line, int len)
+{
+    if(prop->name!=line || prop->value<=prop->name || prop->value>line+len+1)
+        abort();
+    if(strchr(prop->name, '=') || (int)strlen(prop->name)>len)
+        abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    MemoryStream stream;
+    LineReader reader;
+    PropertySet *set;
+    char *text;
+    char *buf;
+    char *line;
+    int bufsize;
+    int len;
+    int n_lines = 0;
+
+    /* The first two bytes choose the buffer size and how much each read
+    returns, so that lines straddle reads and overflow the buffer. */
+    if(size<2)
+        return 0;
+    bufsize = 2+data[0]%128;
+    text = (char *)malloc(size-2+1);
+    memcpy(text, data+2, size-2);
+    stream.data = text;
+    stream.size = size-2;
+    stream.pos = 0;
+    stream.chunk = data[1]%32;
+
+    /* Every line on its own through parse_property. */
+    buf = (char *)malloc(bufsize);
+    init_line_reader(&reader, buf, bufsize, &read_memory, &stream);
+    while((len = next_line(&reader, &line))>=0)
+    {
+        Property prop;
+
+        if(line<buf || len>bufsize-1 || line+len>buf+bufsize-1 || memchr(line, '\n', len))
+            abort();
+        if(parse_property(line, len, &prop)==0)
+            check_property(&prop, line, len);
+        ++n_lines;
+    }
+    if(n_lines>(int)size)
+        abort();
+
+    /* The same stream into a property set, as run_udevadm_properties does. */
+    stream.pos = 0;
+    set = new_properties();
+    init_line_reader(&reader, buf, bufsize, &read_memory, &stream);
+    add_property_lines(set, &reader);
+    for(len=0; len<set->n_props; ++len)
+        if(!set->props[len].name || !set->props[len].value)
+            abort();
+    free_properties(set);
+
+    free(buf);
+    free(text);
+
+    return 0;
+}
+
+#ifdef FUZZ_REPLAY
+int main(int argc, char **argv)
+{
+    uint8_t data[4096];
+    int i;
+
+    if(argc>1)
+    {
+        for(i=1; i<argc; ++i)
+        {
+            FILE *file = fopen(argv[i], "rb");
+            size_t size;
+
+            if(!file)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            size = fread(data, 1, sizeof(data), file);
+            fclose(file);
+            LLVMFuzzerTestOneInput(data, size);
+        }
+        return 0;
+    }
+
+    /* Random inputs made mostly of the characters the parser cares about. */
+    srand(1);
+    for(i=0; i<100000; ++i)
+    {
+        static char alphabet[] = "==\n\n\nAB_z0 \t\r";
+        size_t size = rand()%sizeof(data);
+        size_t j;
+
+        for(j=0; j<size; ++j)
+            data[j] = (j<2 || rand()%8==0 ? rand() : alphabet[rand()%(sizeof(alphabet)-1)]);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("100000 random inputs parsed\n");
+
+    return 0;
+}
+#endif
@@ -0,0 +1,839 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "../devices.h"
+#include "../warmup.h"
+#include "../uevent.h"
+#include "alloc.h"
+#include "fixture.h"
+
+/* Regression tests for the enumeration pipeline: the line reader used for
+udevadm output, device events, automount rules, mount profiles, the warm-up of new mounts,
+starting the -f application, and get_device_nodes, get_device_properties,
+can_mount and get_devices, run against generated fixture trees with every
+enumeration method.  The last test checks that the time and allocations of an
+enumeration grow linearly with the number of devices, which catches quadratic
+regressions without depending on how fast the machine is. */
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if(!(cond)) \
+        { \
+            ++failures; \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+        } \
+    } while(0)
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+/**
+Parses text as udevadm output, with a reader buffer of bufsize bytes and reads
+of at most chunk bytes.
+*/
+static PropertySet *parse_lines(char *text, int bufsize, int chunk, int *n_bad)
+{
+    MemoryStream stream = { text, strlen(text), 0, chunk };
+    LineReader reader;
+    char *buf = (char *)malloc(bufsize);
+    PropertySet *set = new_properties();
+
+    init_line_reader(&reader, buf, bufsize, &read_memory, &stream);
+    *n_bad = add_property_lines(set, &reader);
+    free(buf);
+
+    return set;
+}
+
+/**
+Checks that the properties parsed from text don't depend on how the text
+arrives, and that bad lines are skipped without losing the ones after them.
+*/
+static void test_line_reader(void)
+{
+    static char *text = "DEVNAME=/dev/sdb1\nDEVTYPE=partition\nnot a property\n\n"
+        "ID_FS_LABEL=a=b\nID_FS_LABEL_ENC=0123456789abcdef0123456789abcdef0123456789\nID_BUS=usb";
+    PropertySet *set;
+    int n_bad;
+    int chunk;
+
+    for(chunk=1; chunk<=8; ++chunk)
+    {
+        set = parse_lines(text, 256, chunk, &n_bad);
+        CHECK(set->n_props==5, "%d properties with reads of %d bytes, expected 5", set->n_props, chunk);
+        CHECK(n_bad==1, "%d bad lines with reads of %d bytes, expected 1", n_bad, chunk);
+        CHECK(match_atom_value(set, P_DEVTYPE, "partition"), "DEVTYPE wrong with reads of %d bytes", chunk);
+        CHECK(match_atom_value(set, P_ID_FS_LABEL, "a=b"), "ID_FS_LABEL wrong with reads of %d bytes", chunk);
+        CHECK(match_atom_value(set, P_ID_BUS, "usb"), "last line lost with reads of %d bytes", chunk);
+        free_properties(set);
+    }
+
+    /* The label line doesn't fit in 32 bytes and is dropped on its own. */
+    for(chunk=1; chunk<=40; chunk+=13)
+    {
+        set = parse_lines(text, 32, chunk, &n_bad);
+        CHECK(set->n_props==4, "%d properties with a small buffer, expected 4", set->n_props);
+        CHECK(n_bad==2, "%d bad lines with a small buffer, expected 2", n_bad);
+        CHECK(get_atom_value(set, P_ID_FS_LABEL_ENC)==NULL, "overlong line kept");
+        CHECK(match_atom_value(set, P_ID_BUS, "usb"), "line after an overlong one lost");
+        free_properties(set);
+    }
+
+    set = parse_lines("", 64, 0, &n_bad);
+    CHECK(set->n_props==0 && n_bad==0, "properties found in empty output");
+    free_properties(set);
+}
+
+/* Recorded udevadm monitor --property output: a stick and its partition being
+added by udev, a kernel event that names its device relative to /dev, and a
+removal that the stream ends in the middle of, without the blank line. */
+static char *recorded_events =
+    "monitor will print the received events for:\n"
+    "UDEV - the event which udev sends out after rule processing\n"
+    "\n"
+    "UDEV  [2305.873291] add      /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/block/sdb (block)\n"
+    "ACTION=add\n"
+    "DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/block/sdb\n"
+    "SUBSYSTEM=block\n"
+    "DEVNAME=/dev/sdb\n"
+    "DEVTYPE=disk\n"
+    "MAJOR=8\n"
+    "MINOR=16\n"
+    "ID_BUS=usb\n"
+    "\n"
+    "UDEV  [2305.921557] add      /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/block/sdb/sdb1 (block)\n"
+    "ACTION=add\n"
+    "DEVNAME=/dev/sdb1\n"
+    "DEVTYPE=partition\n"
+    "ID_FS_LABEL=STICK\n"
+    "DEVLINKS=/dev/disk/by-id/usb-Fixture_Stick_0-0:0-part1 /dev/disk/by-label/STICK\n"
+    "\n\n"
+    "KERNEL[2306.002114] change   /devices/virtual/block/loop0 (block)\n"
+    "ACTION=change\n"
+    "DEVNAME=loop0\n"
+    "\n"
+    "UDEV  [2311.400826] remove   /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/block/sdb/sdb1 (block)\n"
+    "ACTION=remove\n"
+    "DEVNAME=/dev/sdb1";
+
+/**
+Replays the recorded events through a pipe in pieces of chunk bytes, reading
+after each piece, and returns the events as a NULL-terminated array.
+*/
+static PropertySet **replay_events(int chunk, int *n_events)
+{
+    PropertySet **events = NULL;
+    UeventSource *src;
+    int len = strlen(recorded_events);
+    int pos = 0;
+    int eof = 0;
+    int fds[2];
+
+    *n_events = 0;
+    if(pipe(fds)<0)
+        return NULL;
+    src = uevent_open_stream(fds[0]);
+
+    while(!eof)
+    {
+        PropertySet **read;
+        int i;
+
+        if(pos<len)
+        {
+            int size = (len-pos<chunk ? len-pos : chunk);
+            if(write(fds[1], recorded_events+pos, size)!=size)
+                break;
+            pos += size;
+            if(pos==len)
+                close(fds[1]);
+        }
+
+        read = uevent_read(src, &eof);
+        for(i=0; read && read[i]; ++i)
+        {
+            events = (PropertySet **)realloc(events, (*n_events+2)*sizeof(PropertySet *));
+            events[(*n_events)++] = read[i];
+            events[*n_events] = NULL;
+        }
+        free(read);
+    }
+    if(pos<len)
+        close(fds[1]);
+    uevent_close(src);
+
+    return events;
+}
+
+/**
+Builds a datagram in the libudev format: the header, whose properties offset
+and size are given, followed by the properties.  Returns its length.
+*/
+static int make_libudev_datagram(char *buf, char *props, int props_len, unsigned offset, unsigned size)
+{
+    unsigned header[4] = { htonl(0xfeedcafe), 40, offset, size };
+
+    memset(buf, 0, 40);
+    memcpy(buf, "libudev", 8);
+    memcpy(buf+8, header, sizeof(header));
+    memcpy(buf+40, props, props_len);
+
+    return 40+props_len;
+}
+
+/**
+Checks that events are read the same whatever pieces the stream arrives in,
+and that both netlink formats are parsed and bad headers are rejected.
+*/
+static void test_uevents(void)
+{
+    static char kernel[] = "add@/devices/virtual/block/loop1\0ACTION=add\0DEVPATH=/devices/virtual/block/loop1\0"
+        "SUBSYSTEM=block\0DEVNAME=loop1\0DEVTYPE=disk\0";
+    static char props[] = "ACTION=remove\0DEVNAME=/dev/sdc1\0DEVTYPE=partition\0";
+    static int chunks[] = { 1, 2, 7, 64, 100000 };
+    char buf[256];
+    PropertySet *set;
+    int len;
+    int i;
+
+    for(i=0; i<(int)(sizeof(chunks)/sizeof(chunks[0])); ++i)
+    {
+        PropertySet **events;
+        int n_events;
+
+        events = replay_events(chunks[i], &n_events);
+        CHECK(n_events==4, "%d events with writes of %d bytes, expected 4", n_events, chunks[i]);
+        if(n_events==4)
+        {
+            CHECK(match_atom_value(events[0], P_DEVNAME, "/dev/sdb") && match_atom_value(events[0], P_ID_BUS, "usb"),
+                "first event wrong with writes of %d bytes", chunks[i]);
+            CHECK(match_atom_value(events[1], P_ID_FS_LABEL, "STICK") && get_atom_value(events[1], P_DEVLINKS),
+                "second event wrong with writes of %d bytes", chunks[i]);
+            CHECK(match_atom_value(events[2], P_DEVNAME, "/dev/loop0"), "kernel DEVNAME %s not made absolute",
+                (get_atom_value(events[2], P_DEVNAME) ? get_atom_value(events[2], P_DEVNAME) : "missing"));
+            CHECK(match_atom_value(events[3], P_ACTION, "remove") && match_atom_value(events[3], P_DEVNAME, "/dev/sdb1"),
+                "unterminated last event wrong with writes of %d bytes", chunks[i]);
+        }
+        free_uevents(events);
+    }
+
+    set = parse_uevent_datagram(kernel, sizeof(kernel)-1);
+    CHECK(set && match_atom_value(set, P_DEVNAME, "/dev/loop1") && match_atom_value(set, P_ACTION, "add"),
+        "kernel datagram parsed wrong");
+    free_properties(set);
+    set = parse_uevent_datagram(kernel, 20);
+    CHECK(!set || !get_atom_value(set, P_DEVNAME), "kernel datagram cut short has a DEVNAME");
+    free_properties(set);
+    set = parse_uevent_datagram("no summary\0ACTION=add\0", 22);
+    CHECK(set==NULL, "kernel datagram without action@devpath parsed");
+    free_properties(set);
+
+    len = make_libudev_datagram(buf, props, sizeof(props)-1, 40, sizeof(props)-1);
+    set = parse_uevent_datagram(buf, len);
+    CHECK(set && match_atom_value(set, P_DEVNAME, "/dev/sdc1") && match_atom_value(set, P_ACTION, "remove"),
+        "libudev datagram parsed wrong");
+    free_properties(set);
+    len = make_libudev_datagram(buf, props, sizeof(props)-1, 40, sizeof(props));
+    CHECK(parse_uevent_datagram(buf, len)==NULL, "libudev datagram with properties past its end parsed");
+    len = make_libudev_datagram(buf, props, sizeof(props)-1, len, 0);
+    CHECK(parse_uevent_datagram(buf, len)==NULL, "libudev datagram with properties out of range parsed");
+    len = make_libudev_datagram(buf, props, sizeof(props)-1, 40, 0xffffffffu);
+    CHECK(parse_uevent_datagram(buf, len)==NULL, "libudev datagram with a huge size parsed");
+    CHECK(parse_uevent_datagram(buf, 20)==NULL, "truncated libudev header parsed");
+}
+
+/**
+Writes text to a new temporary file, whose name is put in filename.  Returns
+0 on success or -1 on failure.
+*/
+static int write_temp_file(char *filename, int size, char *prefix, char *text)
+{
+    FILE *file;
+    int fd;
+
+    snprintf(filename, size, "/tmp/pmount-gui-ng-%s.XXXXXX", prefix);
+    fd = mkstemp(filename);
+    file = (fd==-1 ? NULL : fdopen(fd, "w"));
+    if(!file)
+        return -1;
+    fputs(text, file);
+    fclose(file);
+
+    return 0;
+}
+
+/**
+Makes a property set of a partition with the given bus, label and serial.
+*/
+static PropertySet *make_props(char *bus, char *label, char *serial, char *fs_type)
+{
+    PropertySet *set = new_properties();
+
+    add_property(set, "DEVNAME", "/dev/sdb1");
+    if(bus)
+        add_property(set, "ID_BUS", bus);
+    if(label)
+        add_property(set, "ID_FS_LABEL", label);
+    if(serial)
+        add_property(set, "ID_SERIAL", serial);
+    if(fs_type)
+        add_property(set, "ID_FS_TYPE", fs_type);
+    add_property(set, "ID_USB_DRIVER", "usb-storage");
+
+    return set;
+}
+
+/**
+Checks that automount rules compile to the expected matchers and that the
+first matching rule wins.
+*/
+static void test_rules(void)
+{
+    static char *text = "# comment\n"
+        "ignore ID_FS_TYPE=ntfs\n"
+        "  readonly ID_SERIAL=Kingston_* ID_BUS=usb\n"
+        "automount ID_FS_LABEL=*_BACKUP\n"
+        "bogus ID_BUS=usb\n"
+        "automount ID_FS_LABEL=CAM[0-9]? ID_USB_DRIVER=*\n"
+        "automount ID_BUS!=ata ID_FS_LABEL=STICK\n";
+    static struct
+    {
+        char *bus, *label, *serial, *fs_type;
+        int line;
+        RuleAction action;
+    } cases[] = {
+        { "usb", "DATA", "Kingston_DT_01", "ntfs", 2, ACTION_IGNORE },
+        { "usb", "DATA", "Kingston_DT_01", "vfat", 3, ACTION_READ_ONLY },
+        { "ata", "DATA", "Kingston_DT_01", "vfat", 0, ACTION_NONE },
+        { "ata", "NIGHTLY_BACKUP", NULL, NULL, 4, ACTION_AUTOMOUNT },
+        { "usb", "CAM12", NULL, NULL, 6, ACTION_AUTOMOUNT },
+        { "usb", "CAM1", NULL, NULL, 0, ACTION_NONE },
+        { NULL, "STICK", NULL, NULL, 7, ACTION_AUTOMOUNT },
+        { "ata", "STICK", NULL, NULL, 0, ACTION_NONE },
+    };
+    char filename[64];
+    RuleSet *set;
+    int i;
+
+    if(write_temp_file(filename, sizeof(filename), "rules", text)<0)
+    {
+        CHECK(0, "can't write %s", filename);
+        return;
+    }
+
+    /* The invalid line is reported and skipped. */
+    set = load_rules(filename);
+    unlink(filename);
+    CHECK(set && set->n_rules==5, "%d rules loaded, expected 5", (set ? set->n_rules : -1));
+    if(!set)
+        return;
+    CHECK(set->rules[1].conditions[0].kind==MATCH_PREFIX, "Kingston_* is not a prefix match");
+    CHECK(set->rules[2].conditions[0].kind==MATCH_SUFFIX, "*_BACKUP is not a suffix match");
+    CHECK(set->rules[3].conditions[0].kind==MATCH_GLOB, "CAM[0-9]? is not a glob");
+    CHECK(set->rules[3].conditions[1].kind==MATCH_PRESENT, "* is not a presence check");
+
+    for(i=0; i<(int)(sizeof(cases)/sizeof(cases[0])); ++i)
+    {
+        PropertySet *props = make_props(cases[i].bus, cases[i].label, cases[i].serial, cases[i].fs_type);
+        Rule *rule = match_rules(set, props);
+
+        CHECK((rule ? rule->line : 0)==cases[i].line, "case %d matched line %d, expected %d", i, (rule ? rule->line : 0), cases[i].line);
+        CHECK((rule ? rule->action : ACTION_NONE)==cases[i].action, "case %d has the wrong action", i);
+        free_properties(props);
+    }
+    free_rules(set);
+}
+
+static void write_file(char *dir, char *name)
+{
+    char path[1024];
+    FILE *file;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    file = fopen(path, "w");
+    if(file)
+    {
+        fputs("data\n", file);
+        fclose(file);
+    }
+}
+
+/**
+Checks that mount profiles are picked by filesystem, drive and type in that
+order, turn into the right pmount arguments, and survive being saved.
+*/
+static void test_profiles(void)
+{
+    static char *text = "# comment\n"
+        "fstype=vfat noatime charset=utf8\n"
+        "uuid=3A2F-1C04 sync umask=077\n"
+        "serial=Kingston_DT readonly\n"
+        "label=STICK sync\n"
+        "fstype=exfat umask=7\n"
+        "uuid=3A2F-1C04 noatime\n"
+        "serial=SanDisk defaults\n";
+    char filename[64];
+    char buf[256];
+    char *argv[MAX_PROFILE_ARGS+1];
+    ProfileSet *set;
+    ProfileSet *saved;
+    MountProfile *profile;
+    int argc;
+    int i;
+
+    if(write_temp_file(filename, sizeof(filename), "profiles", text)<0)
+    {
+        CHECK(0, "can't write %s", filename);
+        return;
+    }
+
+    /* The unknown key, the bad umask and the duplicate are reported and
+    skipped. */
+    set = load_profiles(filename);
+    CHECK(set->n_profiles==4, "%d profiles loaded, expected 4", set->n_profiles);
+
+    profile = match_profile(set, "3A2F-1C04", "Kingston_DT", "vfat");
+    CHECK(profile && !strcmp(profile->key, "uuid=3A2F-1C04"), "the filesystem's profile doesn't come first");
+    profile = match_profile(set, "0000-0000", "Kingston_DT", "vfat");
+    CHECK(profile && !strcmp(profile->key, "serial=Kingston_DT"), "the drive's profile doesn't come before the type's");
+    profile = match_profile(set, NULL, NULL, "vfat");
+    CHECK(profile && !strcmp(profile->key, "fstype=vfat"), "no profile for vfat");
+    CHECK(!match_profile(set, NULL, "Other", "ext4"), "a profile matched an unknown device");
+
+    profile = match_profile(set, "3A2F-1C04", NULL, NULL);
+    argc = add_profile_args(profile, argv, 0);
+    argv[argc] = NULL;
+    CHECK(argc==3 && !strcmp(argv[0], "-s") && !strcmp(argv[1], "-u") && !strcmp(argv[2], "077"), "wrong pmount arguments for sync, umask 077");
+    describe_profile(profile, buf, sizeof(buf));
+    CHECK(!strcmp(buf, "sync, umask 077"), "described as %s", buf);
+    describe_profile(find_profile(set, "serial=SanDisk"), buf, sizeof(buf));
+    CHECK(!strcmp(buf, "pmount defaults"), "empty profile described as %s", buf);
+
+    /* An edit as the GUI makes it, then a round trip through the file. */
+    profile = set_profile(set, "serial=Kingston_DT");
+    CHECK(parse_profile_option(profile, "charset=iso8859-1")==0, "charset rejected");
+    CHECK(parse_profile_option(profile, "charset=a b")<0, "charset with a space accepted");
+    remove_profile(set, "fstype=vfat");
+    CHECK(save_profiles(set, filename)==0, "can't save %s", filename);
+    saved = load_profiles(filename);
+    CHECK(saved->n_profiles==set->n_profiles, "%d profiles saved, %d read back", set->n_profiles, saved->n_profiles);
+    for(i=0; i<set->n_profiles && i<saved->n_profiles; ++i)
+    {
+        char expected[256];
+
+        describe_profile(&set->profiles[i], expected, sizeof(expected));
+        describe_profile(&saved->profiles[i], buf, sizeof(buf));
+        CHECK(!strcmp(set->profiles[i].key, saved->profiles[i].key) && !strcmp(expected, buf),
+            "%s: %s read back as %s: %s", set->profiles[i].key, expected, saved->profiles[i].key, buf);
+    }
+    CHECK(!find_profile(saved, "fstype=vfat"), "removed profile saved");
+
+    unlink(filename);
+    free_profiles(saved);
+    free_profiles(set);
+}
+
+/**
+Makes a tree of 5 files and 4 directories, each with 3 files and 2
+subdirectories, each with 2 files and a directory holding one file.
+*/
+static void make_warmup_tree(char *root)
+{
+    char path[1024];
+    int i;
+    int j;
+    int k;
+
+    for(k=0; k<5; ++k)
+    {
+        snprintf(path, sizeof(path), "IMG_%04d.JPG", k);
+        write_file(root, path);
+    }
+    for(i=0; i<4; ++i)
+    {
+        char dir[1024];
+
+        snprintf(dir, sizeof(dir), "%s/d%d", root, i);
+        mkdir(dir, 0755);
+        for(k=0; k<3; ++k)
+        {
+            snprintf(path, sizeof(path), "f%d", k);
+            write_file(dir, path);
+        }
+        for(j=0; j<2; ++j)
+        {
+            char sub[1100];
+
+            snprintf(sub, sizeof(sub), "%s/s%d", dir, j);
+            mkdir(sub, 0755);
+            write_file(sub, "a");
+            write_file(sub, "b");
+            snprintf(path, sizeof(path), "%s/deep", sub);
+            mkdir(path, 0755);
+            write_file(path, "c");
+        }
+    }
+}
+
+/**
+Checks that a warm-up reads as much of a tree as its limits allow, whatever
+the number of threads.
+*/
+static void test_warmup(void)
+{
+    char root[64];
+    WarmupLimits limits;
+    WarmupStats stats;
+    int threads;
+
+    snprintf(root, sizeof(root), "/tmp/pmount-gui-ng-warmup.XXXXXX");
+    if(!mkdtemp(root))
+    {
+        CHECK(0, "can't create %s", root);
+        return;
+    }
+    make_warmup_tree(root);
+
+    for(threads=1; threads<=8; threads*=2)
+    {
+        limits.depth = 2;
+        limits.entries = 0;
+        limits.ms = 0;
+        limits.threads = threads;
+        warm_up_mountpoint(root, &limits, &stats);
+        CHECK(stats.dirs==13 && stats.entries==53, "%d threads, depth 2: %d dirs, %d entries, expected 13 and 53", threads, stats.dirs, stats.entries);
+        CHECK(stats.hinted==5, "%d threads: %d files read ahead, expected 5", threads, stats.hinted);
+        CHECK(!stats.truncated && !stats.errors, "%d threads, depth 2: truncated %d, errors %d", threads, stats.truncated, stats.errors);
+
+        limits.depth = 0;
+        warm_up_mountpoint(root, &limits, &stats);
+        CHECK(stats.dirs==21 && stats.entries==61, "%d threads, no depth limit: %d dirs, %d entries, expected 21 and 61", threads, stats.dirs, stats.entries);
+
+        limits.entries = 10;
+        limits.ms = 5000;
+        warm_up_mountpoint(root, &limits, &stats);
+        CHECK(stats.entries==10 && stats.truncated, "%d threads, 10 entries: %d entries, truncated %d", threads, stats.entries, stats.truncated);
+    }
+
+    remove_fixture(root);
+}
+
+/**
+Checks that %m is expanded in application arguments, and that the application
+starts in the mountpoint.
+*/
+static void test_spawn(void)
+{
+    static char *argv[] = { "sh", "-c", "pwd >cwd; printf %s \"$1\" >arg", "sh", "--path=%m/x%%m", NULL };
+    char dir[64];
+    char path[128];
+    char **args;
+    char *text;
+    int status;
+    pid_t pid;
+
+    snprintf(dir, sizeof(dir), "/tmp/pmount-gui-ng-spawn.XXXXXX");
+    if(!mkdtemp(dir))
+    {
+        CHECK(0, "can't create %s", dir);
+        return;
+    }
+
+    args = expand_mount_args(argv, dir);
+    snprintf(path, sizeof(path), "--path=%s/x%%m", dir);
+    CHECK(!strcmp(args[0], "sh") && !strcmp(args[2], argv[2]), "arguments without %%m changed");
+    CHECK(!strcmp(args[4], path), "expanded to %s, expected %s", args[4], path);
+    CHECK(args[5]==NULL, "arguments not terminated");
+
+    pid = spawn_detached(args, dir);
+    CHECK(pid>0, "could not start sh");
+    if(pid>0)
+    {
+        waitpid(pid, &status, 0);
+        snprintf(path, sizeof(path), "%s/cwd", dir);
+        text = read_small_file(path, NULL);
+        CHECK(text && !strncmp(text, dir, strlen(dir)) && text[strlen(dir)]=='\n', "started in %s, expected %s", text, dir);
+        free(text);
+        snprintf(path, sizeof(path), "%s/arg", dir);
+        text = read_small_file(path, NULL);
+        CHECK(text && !strcmp(text, args[4]), "got argument %s, expected %s", text, args[4]);
+        free(text);
+    }
+    free_args(args);
+
+    args = expand_mount_args((char *[]){ "/nonexistent/application", NULL }, dir);
+    CHECK(spawn_detached(args, dir)==-1, "started a missing application");
+    free_args(args);
+
+    remove_fixture(dir);
+}
+
+/**
+Generates a fixture of count disks in a new temporary directory, and points
+the enumeration at it.
+*/
+static int setup_fixture(char *dir, int size, int count, FixtureInfo *info)
+{
+    snprintf(dir, size, "/tmp/pmount-gui-ng-test.XXXXXX");
+    if(!mkdtemp(dir) || make_fixture(dir, count, info)<0)
+    {
+        fprintf(stderr, "can't generate a fixture of %d devices in %s\n", count, dir);
+        return -1;
+    }
+    snprintf(sysroot, sizeof(sysroot), "%s", dir);
+
+    return 0;
+}
+
+enum { BY_ID, EXPORT_DB, CLASS_BLOCK, N_METHODS };
+static char *method_names[N_METHODS] = { "by-id", "export-db", "class/block" };
+
+/**
+Lists the mountable devices of the current fixture with an enumeration method.
+*/
+static Device **enumerate(int method)
+{
+    use_sysfs_enumeration = (method==CLASS_BLOCK);
+    use_export_db = (method==EXPORT_DB);
+    snprintf(export_db_file, sizeof(export_db_file), "%s/export-db", sysroot);
+    mount_state_loaded = 0;
+
+    return get_devices();
+}
+
+static int count_devices(Device **devices)
+{
+    int n;
+    for(n=0; devices && devices[n]; ++n) ;
+    return n;
+}
+
+static int compare_devnames(const void *a, const void *b)
+{
+    return strcmp((*(Device **)a)->devname, (*(Device **)b)->devname);
+}
+
+/**
+Checks that every method finds the same devices, with the expected labels,
+names and mount state.
+*/
+static void test_enumeration(void)
+{
+    char dir[64];
+    FixtureInfo info;
+    Device **found[N_METHODS];
+    int counts[N_METHODS];
+    int m;
+    int i;
+
+    if(setup_fixture(dir, sizeof(dir), 40, &info)<0)
+    {
+        ++failures;
+        return;
+    }
+
+    for(m=0; m<N_METHODS; ++m)
+    {
+        int mounted = 0;
+
+        found[m] = enumerate(m);
+        counts[m] = count_devices(found[m]);
+        CHECK(counts[m]==info.n_mountable, "%s found %d devices, expected %d", method_names[m], counts[m], info.n_mountable);
+        if(counts[m])
+            qsort(found[m], counts[m], sizeof(Device *), &compare_devnames);
+
+        for(i=0; i<counts[m]; ++i)
+        {
+            Device *dev = found[m][i];
+            char expected[64];
+            int index = atoi(dev->label+2);
+
+            fixture_disk_name(index, expected, sizeof(expected));
+            strcat(expected, "1");
+            CHECK(!strncmp(dev->label, "FX", 2), "%s: %s has label %s", method_names[m], dev->node, dev->label);
+            CHECK(!strcmp(dev->shortdev, expected), "%s: %s is %s, expected %s", method_names[m], dev->node, dev->shortdev, expected);
+            CHECK(index%4!=3 || index%8==3, "%s: internal disk %s listed", method_names[m], dev->node);
+            CHECK(m!=BY_ID || (dev->link && !strcmp(dev->link, dev->node)), "%s: %s is known as %s", method_names[m], dev->node,
+                (dev->link ? dev->link : "nothing"));
+            if(dev->mounted)
+            {
+                ++mounted;
+                CHECK(dev->mountpoint && strstr(dev->mountpoint, dev->label), "%s: %s mounted on %s", method_names[m], dev->node,
+                    (dev->mountpoint ? dev->mountpoint : "nothing"));
+            }
+        }
+        CHECK(mounted==info.n_mounted, "%s found %d mounted devices, expected %d", method_names[m], mounted, info.n_mounted);
+    }
+
+    for(m=1; m<N_METHODS; ++m)
+        if(counts[m]==counts[0])
+            for(i=0; i<counts[0]; ++i)
+                CHECK(found[m][i]->link && found[0][i]->link && !strcmp(found[m][i]->link, found[0][i]->link),
+                    "%s found %s where by-id found %s", method_names[m], found[m][i]->node, found[0][i]->node);
+
+    for(m=0; m<N_METHODS; ++m)
+        free_devices(found[m]);
+    remove_fixture(dir);
+}
+
+/**
+Checks the building blocks on individual devices of a small fixture.
+*/
+static void test_stages(void)
+{
+    char dir[64];
+    char fnbuf[1024];
+    FixtureInfo info;
+    SysfsCache *sysfs;
+    PropertySet *missing;
+    char **nodes;
+    int n_nodes;
+    int i;
+
+    if(setup_fixture(dir, sizeof(dir), 8, &info)<0)
+    {
+        ++failures;
+        return;
+    }
+    mount_state_loaded = 0;
+    load_mount_state();
+
+    /* A link for each disk and each partition. */
+    snprintf(fnbuf, sizeof(fnbuf), "%s/dev/disk/by-id", dir);
+    nodes = get_device_nodes(fnbuf);
+    for(n_nodes=0; nodes && nodes[n_nodes]; ++n_nodes) ;
+    CHECK(n_nodes==2*info.n_devices, "get_device_nodes found %d nodes, expected %d", n_nodes, 2*info.n_devices);
+    free_device_names(nodes);
+
+    /* Sticks by their removable flag, readers by their bus, the internal disk
+    with an fstab entry by its UUID, and no whole disks. */
+    sysfs = new_sysfs_cache();
+    CHECK(sysfs!=NULL, "no sysfs in the fixture");
+    for(i=0; (sysfs && i<8); ++i)
+    {
+        static char *kinds[4] = { "Stick", "Stick", "Reader", NULL };
+        PropertySet *props;
+        int p;
+
+        for(p=0; p<2; ++p)
+        {
+            if(kinds[i%4])
+                snprintf(fnbuf, sizeof(fnbuf), "%s/dev/disk/by-id/usb-Fixture_%s_%d-0:0%s", dir, kinds[i%4], i, (p ? "-part1" : ""));
+            else
+                snprintf(fnbuf, sizeof(fnbuf), "%s/dev/disk/by-id/ata-Fixture_Disk_%d%s", dir, i, (p ? "-part1" : ""));
+
+            props = get_device_properties(fnbuf);
+            CHECK(props!=NULL, "no properties for %s", fnbuf);
+            if(!props)
+                continue;
+            CHECK(match_atom_value(props, P_DEVTYPE, (p ? "partition" : "disk")), "%s has the wrong DEVTYPE", fnbuf);
+            CHECK(can_mount(props, fstab_set, sysfs)==(p && (i%4!=3 || i%8==3)), "can_mount is wrong for %s", fnbuf);
+            free_properties(props);
+        }
+    }
+    free_sysfs_cache(sysfs);
+
+    /* A node the fixture doesn't know must not be looked up on the host. */
+    snprintf(fnbuf, sizeof(fnbuf), "%s/dev/disk/by-id/usb-Not_In_Fixture-part1", dir);
+    missing = get_device_properties(fnbuf);
+    CHECK(missing==NULL, "properties of the host for %s", fnbuf);
+    free_properties(missing);
+
+    remove_fixture(dir);
+}
+
+/**
+Enumerates a fixture a few times and records the fastest time and the
+allocations of one enumeration.
+*/
+static void measure(int method, double *time, unsigned long *allocs)
+{
+    int i;
+
+    *time = -1;
+    for(i=0; i<3; ++i)
+    {
+        unsigned long start_allocs = get_alloc_count();
+        double start = get_time_ms();
+        Device **devices = enumerate(method);
+        double elapsed = get_time_ms()-start;
+
+        *allocs = get_alloc_count()-start_allocs;
+        if(*time<0 || elapsed<*time)
+            *time = elapsed;
+        free_devices(devices);
+    }
+}
+
+/**
+Checks that enumerating ten times as many devices costs about ten times as
+much.  Quadratic behaviour would make it a hundred times.
+*/
+static void test_scaling(void)
+{
+    static int sizes[2] = { 1000, 10000 };
+    char dirs[2][64];
+    FixtureInfo info;
+    double times[2][N_METHODS];
+    unsigned long allocs[2][N_METHODS];
+    int s;
+    int m;
+
+    for(s=0; s<2; ++s)
+    {
+        if(setup_fixture(dirs[s], sizeof(dirs[s]), sizes[s], &info)<0)
+        {
+            ++failures;
+            return;
+        }
+        for(m=0; m<N_METHODS; ++m)
+            measure(m, &times[s][m], &allocs[s][m]);
+        remove_fixture(dirs[s]);
+    }
+
+    for(m=0; m<N_METHODS; ++m)
+    {
+        double time_ratio = times[1][m]/(times[0][m]>0.01 ? times[0][m] : 0.01);
+        double alloc_ratio = (double)allocs[1][m]/(allocs[0][m] ? allocs[0][m] : 1);
+
+        printf("%-12s %6d devices %9.2f ms %9lu allocs, %6d devices %9.2f ms %9lu allocs, ratio %.1f / %.1f\n",
+            method_names[m], sizes[0], times[0][m], allocs[0][m], sizes[1], times[1][m], allocs[1][m], time_ratio, alloc_ratio);
+        CHECK(alloc_ratio<12, "%s allocations grow %.1f times for 10 times the devices", method_names[m], alloc_ratio);
+        CHECK(time_ratio<30, "%s time grows %.1f times for 10 times the devices", method_names[m], time_ratio);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    test_line_reader();
+    test_uevents();
+    test_rules();
+    test_profiles();
+    test_warmup();
+    test_spawn();
+    test_enumeration();
+    test_stages();
+    test_scaling();
+
+    if(failures)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+/* A recorded span.  Times are in microseconds since tracing started. */
+typedef struct sTraceEvent
+{
+    TracePhase phase;
+    double start;
+    double duration;
+    char *detail;
+    int tid;
+} TraceEvent;
+
+static char *phase_names[N_TRACE_PHASES] =
+{
+    "scan",
+    "properties",
+    "sysfs",
+    "mount-table",
+    "widgets",
+    "first-frame",
+    "mount-command",
+    "flush",
+    "warm-up"
+};
+
+int tracing = 0;
+
+static double origin;
+static TraceEvent *events = NULL;
+static int n_events = 0;
+static int n_alloc = 0;
+/* Spans may be recorded from worker threads. */
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+Returns the monotonic clock in microseconds.
+*/
+static double get_monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000.0+ts.tv_nsec/1000.0;
+}
+
+/**
+Starts recording spans.  Times are measured from this call, so it should be
+made as early as possible.
+*/
+void start_tracing(void)
+{
+    origin = get_monotonic_us();
+    tracing = 1;
+}
+
+/**
+Returns the current time for starting a span, or 0 if not tracing.
+*/
+double trace_now(void)
+{
+    if(!tracing)
+        return 0;
+    return get_monotonic_us()-origin;
+}
+
+/**
+Records a span of a phase from start until now.  The detail string, e.g. a
+device name, is copied and may be NULL.
+*/
+void trace_span(TracePhase phase, double start, char *detail)
+{
+    TraceEvent *ev;
+    double end;
+
+    if(!tracing)
+        return;
+    end = trace_now();
+
+    pthread_mutex_lock(&events_lock);
+    if(n_events>=n_alloc)
+    {
+        n_alloc = (n_alloc ? n_alloc*2 : 64);
+        events = (TraceEvent *)realloc(events, n_alloc*sizeof(TraceEvent));
+    }
+
+    ev = &events[n_events++];
+    ev->phase = phase;
+    ev->start = start;
+    ev->duration = end-start;
+    ev->detail = (detail ? strdup(detail) : NULL);
+    ev->tid = (int)syscall(SYS_gettid);
+    pthread_mutex_unlock(&events_lock);
+}
+
+/**
+Writes a string as a JSON string literal, or null if the string is NULL.
+*/
+void write_json_string(FILE *file, char *str)
+{
+    if(!str)
+    {
+        fputs("null", file);
+        return;
+    }
+
+    fputc('"', file);
+    for(; *str; ++str)
+    {
+        unsigned char c = *str;
+        if(c=='"' || c=='\\')
+            fprintf(file, "\\%c", c);
+        else if(c<0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+Writes the recorded spans in the Chrome trace event format, which can be
+loaded in chrome://tracing or Perfetto.  Returns 0 on success or -1 if the
+file could not be written.
+*/
+int write_trace(char *filename)
+{
+    FILE *file;
+    int pid = getpid();
+    int i;
+
+    file = fopen(filename, "w");
+    if(!file)
+        return -1;
+
+    pthread_mutex_lock(&events_lock);
+    fputs("{\"traceEvents\": [", file);
+    for(i=0; i<n_events; ++i)
+    {
+        TraceEvent *ev = &events[i];
+        fprintf(file, "%s\n {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+            (i ? "," : ""), phase_names[ev->phase], ev->start, ev->duration, pid, ev->tid);
+        if(ev->detail)
+        {
+            fputs(", \"args\": {\"detail\": ", file);
+            write_json_string(file, ev->detail);
+            fputc('}', file);
+        }
+        fputc('}', file);
+    }
+    fputs("\n], \"displayTimeUnit\": \"ms\"}\n", file);
+    pthread_mutex_unlock(&events_lock);
+
+    return (fclose(file)==0 ? 0 : -1);
+}
+
+/**
+Prints the total time and number of spans of each phase that was seen, on one
+line.
+*/
+void print_trace_summary(FILE *file)
+{
+    double totals[N_TRACE_PHASES] = { 0 };
+    int counts[N_TRACE_PHASES] = { 0 };
+    int i;
+
+    pthread_mutex_lock(&events_lock);
+    for(i=0; i<n_events; ++i)
+    {
+        totals[events[i].phase] += events[i].duration;
+        ++counts[events[i].phase];
+    }
+    pthread_mutex_unlock(&events_lock);
+
+    fprintf(file, "trace: total %.2fms", trace_now()/1000);
+    for(i=0; i<N_TRACE_PHASES; ++i)
+        if(counts[i])
+            fprintf(file, " %s %.2fms/%d", phase_names[i], totals[i]/1000, counts[i]);
+    fputc('\n', file);
+}
+
+/**
+Frees the recorded spans.
+*/
+void free_trace(void)
+{
+    int i;
+
+    pthread_mutex_lock(&events_lock);
+    for(i=0; i<n_events; ++i)
+        free(events[i].detail);
+    free(events);
+    events = NULL;
+    n_events = 0;
+    n_alloc = 0;
+    pthread_mutex_unlock(&events_lock);
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* Stages of the program whose duration is recorded. */
+typedef enum
+{
+    T_SCAN, // listing /dev/disk/by-id
+    T_PROPERTIES, // fetching udev properties
+    T_SYSFS, // removable and bus checks
+    T_MOUNT_TABLE, // reading mountinfo and fstab
+    T_WIDGETS, // creating rows
+    T_FIRST_FRAME, // from startup until the window is first drawn
+    T_MOUNT_COMMAND, // lifetime of a pmount or pumount
+    T_FLUSH, // writing back a filesystem before unmounting it
+    T_WARMUP, // reading the directories of a new mount
+    N_TRACE_PHASES
+} TracePhase;
+
+/* Nonzero once start_tracing has been called.  Until then spans cost nothing
+and are not recorded. */
+extern int tracing;
+
+void start_tracing(void);
+double trace_now(void);
+void trace_span(TracePhase phase, double start, char *detail);
+void write_json_string(FILE *file, char *str);
+int write_trace(char *filename);
+void print_trace_summary(FILE *file);
+void free_trace(void);
+
+#endif
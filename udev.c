@@ -0,0 +1,954 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "udev.h"
+#include "child.h"
+
+char sysroot[1024] = "";
+char sysfs_root[1024] = "";
+
+/* A chunk of memory owned by a property set.  Blocks are either allocated for
+the arena or adopted buffers that properties were parsed from in place. */
+struct sArenaBlock
+{
+    ArenaBlock *next;
+    char *mem;
+    int size;
+    int used;
+};
+
+#define ARENA_BLOCK_SIZE 1024
+
+/* Largest udev database dump that is read; a real one is a few megabytes at
+most. */
+#define EXPORT_DB_LIMIT (64<<20)
+
+static char *atom_names[N_PROPERTY_ATOMS] =
+{
+    "DEVNAME",
+    "DEVTYPE",
+    "DEVPATH",
+    "SUBSYSTEM",
+    "MAJOR",
+    "MINOR",
+    "ACTION",
+    "ID_BUS",
+    "ID_TYPE",
+    "ID_FS_LABEL",
+    "ID_FS_UUID",
+    "ID_VENDOR",
+    "ID_MODEL",
+    "ID_CDROM_MEDIA",
+    "DEVLINKS",
+    "ID_FS_LABEL_ENC",
+    "ID_PART_ENTRY_UUID",
+    "ID_PART_ENTRY_NAME",
+    "ID_SERIAL",
+    "ID_FS_TYPE"
+};
+
+/**
+Returns the atom of an interned property name, or P_NONE if the name is not
+interned.
+*/
+int property_atom(char *name)
+{
+    int i;
+
+    /* All interned names start with D, S, M, A or I; most other properties
+    can be rejected without comparing anything. */
+    switch(name[0])
+    {
+    case 'D': case 'S': case 'M': case 'A': case 'I':
+        break;
+    default:
+        return P_NONE;
+    }
+
+    for(i=0; i<N_PROPERTY_ATOMS; ++i)
+        if(atom_names[i][0]==name[0] && !strcmp(atom_names[i], name))
+            return i;
+
+    return P_NONE;
+}
+
+/**
+Creates an empty property set.
+*/
+PropertySet *new_properties(void)
+{
+    return (PropertySet *)calloc(1, sizeof(PropertySet));
+}
+
+/**
+Allocates memory that lives as long as a property set.
+*/
+char *properties_alloc(PropertySet *set, int size)
+{
+    ArenaBlock *block = set->arena;
+    char *mem;
+
+    if(!block || block->size-block->used<size)
+    {
+        block = (ArenaBlock *)malloc(sizeof(ArenaBlock));
+        block->size = (size>ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        block->mem = (char *)malloc(block->size);
+        block->used = 0;
+        block->next = set->arena;
+        set->arena = block;
+    }
+
+    mem = block->mem+block->used;
+    block->used += size;
+
+    return mem;
+}
+
+/**
+Hands a malloc'd buffer over to a property set, so that properties can point
+into it.  The buffer is freed along with the set.
+*/
+void properties_adopt(PropertySet *set, char *buf)
+{
+    ArenaBlock *block;
+
+    block = (ArenaBlock *)malloc(sizeof(ArenaBlock));
+    block->mem = buf;
+    block->size = 0;
+    block->used = 0;
+
+    /* Keep the block being allocated from at the head. */
+    if(set->arena)
+    {
+        block->next = set->arena->next;
+        set->arena->next = block;
+    }
+    else
+    {
+        block->next = NULL;
+        set->arena = block;
+    }
+}
+
+/**
+Adds a property to a set.  The strings are not copied; they must be owned by
+the set or outlive it.
+*/
+void add_property(PropertySet *set, char *name, char *value)
+{
+    int atom;
+
+    if(set->n_props+1>=set->n_alloc)
+    {
+        set->n_alloc = (set->n_alloc ? set->n_alloc*2 : 32);
+        set->props = (Property *)realloc(set->props, set->n_alloc*sizeof(Property));
+    }
+
+    set->props[set->n_props].name = name;
+    set->props[set->n_props].value = value;
+    ++set->n_props;
+    set->props[set->n_props].name = NULL;
+    set->props[set->n_props].value = NULL;
+
+    atom = property_atom(name);
+    if(atom!=P_NONE)
+        set->atoms[atom] = value;
+}
+
+/**
+Adds a property to a set, copying the name and value into the set's arena.
+*/
+void add_property_copy(PropertySet *set, char *name, int name_len, char *value, int value_len)
+{
+    char *mem;
+
+    mem = properties_alloc(set, name_len+value_len+2);
+    memcpy(mem, name, name_len);
+    mem[name_len] = 0;
+    memcpy(mem+name_len+1, value, value_len);
+    mem[name_len+1+value_len] = 0;
+
+    add_property(set, mem, mem+name_len+1);
+}
+
+/**
+Parses a string of the form name=value and points the components of a Property
+structure at it.  The string is split in place: the equals sign and the
+character at str[size], which must be writable, are replaced by terminators.
+Returns 0 on success, or -1 if the string wasn't a valid property.
+*/
+int parse_property(char *str, int size, Property *prop)
+{
+    char *equals;
+
+    equals = memchr(str, '=', size);
+    if(!equals)
+        return -1;
+
+    *equals = 0;
+    str[size] = 0;
+    prop->name = str;
+    prop->value = equals+1;
+
+    return 0;
+}
+
+/**
+Prepares to read lines from a stream into buf.  One byte of the buffer is kept
+free, so that the character after every line returned is writable as
+parse_property requires.
+*/
+void init_line_reader(LineReader *reader, char *buf, int size, ReadFunc read, void *data)
+{
+    memset(reader, 0, sizeof(LineReader));
+    reader->read = read;
+    reader->data = data;
+    reader->buf = buf;
+    reader->size = size;
+}
+
+/**
+Finds the next line of a stream.  Points line at it in the reader's buffer and
+returns its length without the newline, or returns -1 at the end of the stream
+or after a read error.  The line stays valid until the next call.  A last line
+without a newline is returned too, unless reading failed and it may be cut
+short.
+*/
+int next_line(LineReader *reader, char **line)
+{
+    while(1)
+    {
+        char *newline = NULL;
+        int len;
+
+        if(reader->scan<reader->end)
+            newline = (char *)memchr(reader->buf+reader->scan, '\n', reader->end-reader->scan);
+        if(newline)
+        {
+            char *begin = reader->buf+reader->start;
+            int skipped = reader->skipping;
+
+            reader->start = reader->scan = newline-reader->buf+1;
+            reader->skipping = 0;
+            if(skipped)
+                continue;
+
+            *line = begin;
+            return newline-begin;
+        }
+        reader->scan = reader->end;
+
+        if(reader->eof || reader->error)
+        {
+            if(reader->start>=reader->end || reader->skipping || reader->error)
+                return -1;
+
+            *line = reader->buf+reader->start;
+            len = reader->end-reader->start;
+            reader->start = reader->end;
+            return len;
+        }
+
+        /* Make room by moving the incomplete line to the front.  If it fills
+        the whole buffer, drop it along with the rest up to the next newline. */
+        if(reader->start>0)
+        {
+            memmove(reader->buf, reader->buf+reader->start, reader->end-reader->start);
+            reader->end -= reader->start;
+            reader->scan = reader->end;
+            reader->start = 0;
+        }
+        if(reader->end>=reader->size-1)
+        {
+            if(!reader->skipping)
+                ++reader->n_skipped;
+            reader->skipping = 1;
+            reader->start = reader->scan = reader->end = 0;
+        }
+
+        len = reader->read(reader->data, reader->buf+reader->end, reader->size-1-reader->end);
+        if(len==0)
+            reader->eof = 1;
+        else if(len<0)
+            reader->error = 1;
+        else
+            reader->end += len;
+    }
+}
+
+/**
+Adds the name=value lines of a stream to a property set, copying them to the
+set's arena.  Lines that aren't properties are skipped.  Returns the number of
+lines skipped, including ones too long for the reader's buffer.
+*/
+int add_property_lines(PropertySet *set, LineReader *reader)
+{
+    char *line;
+    int len;
+    int n_bad = 0;
+
+    while((len = next_line(reader, &line))>=0)
+    {
+        Property prop;
+
+        if(parse_property(line, len, &prop)<0)
+        {
+            if(len>0)
+                ++n_bad;
+            continue;
+        }
+
+        add_property_copy(set, prop.name, prop.value-1-prop.name, prop.value, line+len-prop.value);
+    }
+
+    return n_bad+reader->n_skipped;
+}
+
+/**
+Reads everything from a file descriptor into a newly allocated, NUL-terminated
+buffer.  Returns NULL on a read error.
+*/
+static char *read_all(int fd, int *size)
+{
+    char *buf;
+    int bufsize = 1024;
+    int pos = 0;
+
+    buf = (char *)malloc(bufsize);
+    while(1)
+    {
+        int len;
+
+        if(pos+1>=bufsize)
+        {
+            bufsize *= 2;
+            buf = (char *)realloc(buf, bufsize);
+        }
+
+        len = read(fd, buf+pos, bufsize-pos-1);
+        if(len==-1)
+        {
+            free(buf);
+            return NULL;
+        }
+        else if(len==0)
+            break;
+        pos += len;
+    }
+
+    buf[pos] = 0;
+    if(size)
+        *size = pos;
+
+    return buf;
+}
+
+/**
+Creates the directory a file is in, and its parent if that is missing too, as
+for ~/.cache/pmount-gui-ng/devices.
+*/
+void make_file_dir(char *filename)
+{
+    char dirname[1100];
+    char *ptr;
+
+    snprintf(dirname, sizeof(dirname), "%s", filename);
+    ptr = strrchr(dirname, '/');
+    if(!ptr)
+        return;
+    *ptr = 0;
+    if(mkdir(dirname, 0700)<0 && (ptr = strrchr(dirname, '/')))
+    {
+        *ptr = 0;
+        mkdir(dirname, 0700);
+        *ptr = '/';
+        mkdir(dirname, 0700);
+    }
+}
+
+/**
+Reads a small file into a newly allocated, NUL-terminated buffer.  Returns NULL
+if the file could not be read.
+*/
+char *read_small_file(char *filename, int *size)
+{
+    int fd;
+    char *buf;
+
+    fd = open(filename, O_RDONLY);
+    if(fd==-1)
+        return NULL;
+
+    buf = read_all(fd, size);
+    close(fd);
+
+    return buf;
+}
+
+/**
+Writes the directory sysfs is read from to buf.
+*/
+void get_sysfs_root(char *buf, int size)
+{
+    if(sysfs_root[0])
+        snprintf(buf, size, "%s", sysfs_root);
+    else
+        snprintf(buf, size, "%s/sys", sysroot);
+}
+
+/**
+Finds the major:minor number of a block device node and writes it to buf.  The
+node is usually a symlink in /dev/disk/by-id; the name of its target is looked
+up in sysfs first so that this also works on fixture trees that contain no real
+device nodes.  Returns 0 on success or -1 on failure.
+*/
+int get_node_devnum(char *node, char *buf, int size)
+{
+    char linkbuf[1024];
+    char fnbuf[1024];
+    char *name;
+    char *ptr;
+    char *dev;
+    struct stat st;
+    int len;
+
+    name = node;
+    len = readlink(node, linkbuf, sizeof(linkbuf)-1);
+    if(len!=-1)
+    {
+        linkbuf[len] = 0;
+        name = linkbuf;
+    }
+    for(ptr=name; *ptr; ++ptr)
+        if(*ptr=='/')
+            name = ptr+1;
+
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    snprintf(fnbuf+strlen(fnbuf), sizeof(fnbuf)-strlen(fnbuf), "/class/block/%s/dev", name);
+    dev = read_small_file(fnbuf, NULL);
+    if(dev)
+    {
+        for(ptr=dev; (*ptr && *ptr!='\n'); ++ptr) ;
+        *ptr = 0;
+        snprintf(buf, size, "%s", dev);
+        free(dev);
+        return 0;
+    }
+
+    if(stat(node, &st)==0 && S_ISBLK(st.st_mode))
+    {
+        snprintf(buf, size, "%u:%u", major(st.st_rdev), minor(st.st_rdev));
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+Retrieves the properties of a /dev node directly from the kernel's uevent file
+in sysfs and the udev database in /run/udev/data, without running any external
+programs.  The result contains the same properties as udevadm info would
+report.  Both files are parsed in place.  Returns NULL if the device is not
+known to udev.
+*/
+PropertySet *read_udev_properties(char *node)
+{
+    char devnum[64];
+    char fnbuf[1024];
+    char linkbuf[1024];
+    char *uevent;
+    char *db;
+    char *line;
+    char *end;
+    PropertySet *set;
+    char *devlinks = NULL;
+    int devlinks_len = 0;
+    int len;
+
+    if(get_node_devnum(node, devnum, sizeof(devnum))<0)
+        return NULL;
+
+    snprintf(fnbuf, sizeof(fnbuf), "%s/run/udev/data/b%s", sysroot, devnum);
+    db = read_small_file(fnbuf, NULL);
+    if(!db)
+        return NULL;
+
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    snprintf(fnbuf+strlen(fnbuf), sizeof(fnbuf)-strlen(fnbuf), "/dev/block/%s/uevent", devnum);
+    uevent = read_small_file(fnbuf, NULL);
+    if(!uevent)
+    {
+        free(db);
+        return NULL;
+    }
+
+    if(verbosity>=2)
+        printf("Reading udev database entry b%s for \"%s\"\n", devnum, node);
+
+    set = new_properties();
+    properties_adopt(set, db);
+    properties_adopt(set, uevent);
+
+    /* The sysfs link points to the device's directory under /sys/devices;
+    strip the leading ../ components to get the DEVPATH. */
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    snprintf(fnbuf+strlen(fnbuf), sizeof(fnbuf)-strlen(fnbuf), "/dev/block/%s", devnum);
+    len = readlink(fnbuf, linkbuf, sizeof(linkbuf)-1);
+    if(len!=-1)
+    {
+        char *ptr = linkbuf;
+
+        linkbuf[len] = 0;
+        while(!strncmp(ptr, "../", 3))
+            ptr += 3;
+        if(ptr>linkbuf)
+        {
+            --ptr;
+            *ptr = '/';
+        }
+        add_property_copy(set, "DEVPATH", 7, ptr, strlen(ptr));
+    }
+
+    add_property(set, "SUBSYSTEM", "block");
+
+    for(line=uevent; *line; line=end)
+    {
+        Property prop;
+
+        end = strchr(line, '\n');
+        if(!end)
+            end = line+strlen(line);
+        len = end-line;
+        if(*end)
+            ++end;
+
+        if(parse_property(line, len, &prop)<0)
+            continue;
+
+        if(!strcmp(prop.name, "DEVNAME") && prop.value[0]!='/')
+        {
+            char devname[1024];
+            len = snprintf(devname, sizeof(devname), "/dev/%s", prop.value);
+            add_property_copy(set, "DEVNAME", 7, devname, len);
+        }
+        else
+            add_property(set, prop.name, prop.value);
+    }
+
+    /* Database lines have a one-letter type followed by a colon.  E is a
+    property and S is a symlink relative to /dev. */
+    for(line=db; *line; line=end)
+    {
+        end = strchr(line, '\n');
+        if(!end)
+            end = line+strlen(line);
+        len = end-line;
+        if(*end)
+            ++end;
+
+        if(line[0]=='E' && line[1]==':')
+        {
+            Property prop;
+            if(parse_property(line+2, len-2, &prop)==0)
+                add_property(set, prop.name, prop.value);
+        }
+        else if(line[0]=='S' && line[1]==':')
+        {
+            devlinks = (char *)realloc(devlinks, devlinks_len+len+7);
+            devlinks_len += sprintf(devlinks+devlinks_len, "%s/dev/%.*s", (devlinks_len ? " " : ""), len-2, line+2);
+        }
+    }
+
+    if(devlinks)
+    {
+        add_property_copy(set, "DEVLINKS", 8, devlinks, devlinks_len);
+        free(devlinks);
+    }
+
+    return set;
+}
+
+static int read_from_child(void *data, char *buf, int size)
+{
+    return read_child((Child *)data, buf, size);
+}
+
+/**
+Retrieves all properties associated with a /dev node by running udevadm.
+Returns NULL if there were none.  Use free_properties to free the set.
+*/
+PropertySet *run_udevadm_properties(char *node)
+{
+    Child child;
+    char *argv[] = { "/sbin/udevadm", "info", "-q", "property", "-n", node, NULL };
+
+    if(start_child(&child, C_UDEVADM, argv)==0)
+    {
+        char buf[PROPERTY_LINE_MAX];
+        LineReader reader;
+        PropertySet *set = new_properties();
+        int n_bad;
+
+        init_line_reader(&reader, buf, sizeof(buf), &read_from_child, &child);
+        n_bad = add_property_lines(set, &reader);
+        if(n_bad && verbosity>=2)
+            printf("  Skipped %d malformed lines from udevadm\n", n_bad);
+
+        /* Properties of a udevadm that timed out may be incomplete. */
+        wait_child(&child);
+        if(child.timed_out)
+            set->n_props = 0;
+        free_child(&child);
+
+        if(!set->n_props)
+        {
+            free_properties(set);
+            return NULL;
+        }
+
+        return set;
+    }
+    else
+    {
+        free_child(&child);
+
+        return NULL;
+    }
+}
+
+/**
+Retrieves all properties associated with a /dev node.  The udev database is
+read directly if possible; udevadm is used as a fallback, except below a
+sysroot, where it would describe the host's devices instead.  Use
+free_properties to free the set.
+*/
+PropertySet *get_device_properties(char *node)
+{
+    PropertySet *set;
+
+    set = read_udev_properties(node);
+    if(set || sysroot[0])
+        return set;
+
+    if(verbosity>=2)
+        printf("  No udev database entry, falling back to udevadm\n");
+
+    return run_udevadm_properties(node);
+}
+
+/**
+Hashes a string for the udev index.
+*/
+static unsigned hash_string(char *str)
+{
+    unsigned h = 2166136261u;
+    for(; *str; ++str)
+        h = (h^(unsigned char)*str)*16777619u;
+    return h;
+}
+
+/**
+Inserts an entry into one of the hash tables of a udev index.  Slots hold entry
+indices plus one, so that zero marks an empty slot.
+*/
+static void index_insert(UdevIndex *index, int *slots, char *key, int entry)
+{
+    unsigned mask = index->n_slots-1;
+    unsigned i;
+
+    if(!key)
+        return;
+
+    for(i=hash_string(key)&mask; slots[i]; i=(i+1)&mask) ;
+    slots[i] = entry+1;
+}
+
+/**
+Looks up an entry from one of the hash tables of a udev index.
+*/
+static UdevEntry *index_find(UdevIndex *index, int *slots, char *key, int by_devnum)
+{
+    unsigned mask = index->n_slots-1;
+    unsigned i;
+
+    if(!index->n_slots || !key)
+        return NULL;
+
+    for(i=hash_string(key)&mask; slots[i]; i=(i+1)&mask)
+    {
+        UdevEntry *entry = &index->entries[slots[i]-1];
+        if(!strcmp(by_devnum ? entry->devnum : entry->devname, key))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+Finishes a record of the export-db stream.  Block devices are added to the
+index and everything else is discarded.
+*/
+static void index_add_record(UdevIndex *index, PropertySet *props, int *n_alloc)
+{
+    char *major;
+    char *minor;
+    UdevEntry *entry;
+    int len;
+
+    if(!props)
+        return;
+
+    major = get_atom_value(props, P_MAJOR);
+    minor = get_atom_value(props, P_MINOR);
+    if(!match_atom_value(props, P_SUBSYSTEM, "block") || !major || !minor)
+    {
+        free_properties(props);
+        return;
+    }
+
+    if(index->n_entries>=*n_alloc)
+    {
+        *n_alloc = (*n_alloc ? *n_alloc*2 : 64);
+        index->entries = (UdevEntry *)realloc(index->entries, *n_alloc*sizeof(UdevEntry));
+    }
+
+    entry = &index->entries[index->n_entries++];
+    entry->props = props;
+    entry->devname = get_atom_value(props, P_DEVNAME);
+    len = strlen(major)+strlen(minor)+2;
+    entry->devnum = properties_alloc(props, len);
+    snprintf(entry->devnum, len, "%s:%s", major, minor);
+}
+
+/**
+Parses the output of udevadm info --export-db in a single pass and builds an
+index of all block devices in it.  Records are separated by empty lines; the
+E: lines of each record hold its properties.  The properties are parsed in
+place, so the index takes ownership of the buffer.
+*/
+UdevIndex *parse_udev_export_db(char *buf)
+{
+    UdevIndex *index;
+    PropertySet *props = NULL;
+    int n_alloc = 0;
+    char *line;
+    char *end;
+    int i;
+
+    index = (UdevIndex *)calloc(1, sizeof(UdevIndex));
+    index->buf = buf;
+
+    for(line=buf; *line; line=end)
+    {
+        int len;
+
+        end = strchr(line, '\n');
+        if(!end)
+            end = line+strlen(line);
+        len = end-line;
+        if(*end)
+            ++end;
+
+        if(!len)
+        {
+            index_add_record(index, props, &n_alloc);
+            props = NULL;
+        }
+        else if(line[0]=='E' && line[1]==':')
+        {
+            Property prop;
+            int skip = 2;
+
+            while(line[skip]==' ')
+                ++skip;
+            if(parse_property(line+skip, len-skip, &prop)<0)
+                continue;
+            if(!props)
+                props = new_properties();
+            add_property(props, prop.name, prop.value);
+        }
+        else
+            line[len] = 0;
+    }
+    index_add_record(index, props, &n_alloc);
+    /* Keep the tables at most half full. */
+    for(index->n_slots=16; index->n_slots<index->n_entries*2; index->n_slots*=2) ;
+    index->by_devname = (int *)calloc(index->n_slots, sizeof(int));
+    index->by_devnum = (int *)calloc(index->n_slots, sizeof(int));
+    for(i=0; i<index->n_entries; ++i)
+    {
+        index_insert(index, index->by_devname, index->entries[i].devname, i);
+        index_insert(index, index->by_devnum, index->entries[i].devnum, i);
+    }
+
+    if(verbosity>=1)
+        printf("Indexed %d block devices from the udev database\n", index->n_entries);
+
+    return index;
+}
+
+/**
+Builds an index of all block devices known to udev.  If filename is given, a
+saved dump of udevadm info --export-db is read from it; otherwise udevadm is
+run once.  Returns NULL on failure.
+*/
+UdevIndex *load_udev_index(char *filename)
+{
+    char *buf;
+    Child child;
+    char *argv[] = { "/sbin/udevadm", "info", "--export-db", NULL };
+
+    if(filename)
+    {
+        buf = read_small_file(filename, NULL);
+        if(!buf)
+            return NULL;
+        return parse_udev_export_db(buf);
+    }
+
+    if(start_child(&child, C_UDEVADM, argv)<0)
+    {
+        free_child(&child);
+        return NULL;
+    }
+
+    /* An incomplete database would hide devices, so the caller is left to
+    fall back to examining them one by one. */
+    child.limit = EXPORT_DB_LIMIT;
+    if(wait_child(&child)<0 || !child_succeeded(&child) || child.truncated)
+    {
+        if(verbosity>=1 && child.truncated)
+            printf("udevadm info --export-db printed more than %d bytes\n", EXPORT_DB_LIMIT);
+        free_child(&child);
+        return NULL;
+    }
+
+    buf = child.output;
+    child.output = NULL;
+    free_child(&child);
+
+    return parse_udev_export_db(buf);
+}
+
+/**
+Finds the properties of a /dev node in a udev index.  The node is matched by
+device number if possible, or by the name of its symlink target otherwise.  The
+returned set is owned by the index and must not be freed.
+*/
+PropertySet *udev_index_lookup_node(UdevIndex *index, char *node)
+{
+    char devnum[64];
+    char linkbuf[1024];
+    char devname[1024];
+    UdevEntry *entry = NULL;
+    char *name;
+    char *ptr;
+    int len;
+
+    if(get_node_devnum(node, devnum, sizeof(devnum))==0)
+        entry = index_find(index, index->by_devnum, devnum, 1);
+
+    if(!entry)
+    {
+        name = node;
+        len = readlink(node, linkbuf, sizeof(linkbuf)-1);
+        if(len!=-1)
+        {
+            linkbuf[len] = 0;
+            name = linkbuf;
+        }
+        for(ptr=name; *ptr; ++ptr)
+            if(*ptr=='/')
+                name = ptr+1;
+
+        snprintf(devname, sizeof(devname), "/dev/%s", name);
+        entry = index_find(index, index->by_devname, devname, 0);
+    }
+
+    return (entry ? entry->props : NULL);
+}
+
+/**
+Frees a udev index and all property sets contained in it.
+*/
+void free_udev_index(UdevIndex *index)
+{
+    int i;
+    if(!index)
+        return;
+    for(i=0; i<index->n_entries; ++i)
+        free_properties(index->entries[i].props);
+    free(index->entries);
+    free(index->buf);
+    free(index->by_devname);
+    free(index->by_devnum);
+    free(index);
+}
+
+/**
+Looks for a property in a set and returns its value.  Interned names are
+looked up directly; others are searched for.  Returns NULL if the property was
+not found.
+*/
+char *get_property_value(PropertySet *set, char *name)
+{
+    int atom;
+    int i;
+
+    atom = property_atom(name);
+    if(atom!=P_NONE)
+        return set->atoms[atom];
+
+    for(i=0; i<set->n_props; ++i)
+        if(strcmp(set->props[i].name, name)==0)
+            return set->props[i].value;
+    return NULL;
+}
+
+/**
+Checks if a property has a specific value.  A NULL value is matched if the
+property does not exist.
+*/
+int match_property_value(PropertySet *set, char *name, char *value)
+{
+    char *v = get_property_value(set, name);
+    if(!v)
+        return value==NULL;
+    return value && strcmp(v, value)==0;
+}
+
+/**
+Checks if an interned property has a specific value.  A NULL value is matched
+if the property does not exist.
+*/
+int match_atom_value(PropertySet *set, PropertyAtom atom, char *value)
+{
+    char *v = set->atoms[atom];
+    if(!v)
+        return value==NULL;
+    return value && strcmp(v, value)==0;
+}
+
+/**
+Frees a property set along with all memory its properties point into.
+*/
+void free_properties(PropertySet *set)
+{
+    ArenaBlock *block;
+
+    if(!set)
+        return;
+
+    while((block = set->arena))
+    {
+        set->arena = block->next;
+        free(block->mem);
+        free(block);
+    }
+    free(set->props);
+    free(set);
+}
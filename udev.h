@@ -0,0 +1,139 @@
+#ifndef UDEV_H
+#define UDEV_H
+
+typedef struct sProperty
+{
+    char *name;
+    char *value;
+} Property;
+
+/* Keys that the rest of the program looks up.  Their values are kept in a
+table indexed by atom, so looking them up needs no string comparisons. */
+typedef enum
+{
+    P_NONE = -1,
+    P_DEVNAME,
+    P_DEVTYPE,
+    P_DEVPATH,
+    P_SUBSYSTEM,
+    P_MAJOR,
+    P_MINOR,
+    P_ACTION,
+    P_ID_BUS,
+    P_ID_TYPE,
+    P_ID_FS_LABEL,
+    P_ID_FS_UUID,
+    P_ID_VENDOR,
+    P_ID_MODEL,
+    P_ID_CDROM_MEDIA,
+    P_DEVLINKS,
+    P_ID_FS_LABEL_ENC,
+    P_ID_PART_ENTRY_UUID,
+    P_ID_PART_ENTRY_NAME,
+    P_ID_SERIAL,
+    P_ID_FS_TYPE,
+    N_PROPERTY_ATOMS
+} PropertyAtom;
+
+typedef struct sArenaBlock ArenaBlock;
+
+/* The properties of one device.  Names and values point into memory owned by
+the set: either buffers the properties were parsed from in place, or blocks
+of the set's arena.  Everything is freed at once by free_properties. */
+typedef struct sPropertySet
+{
+    Property *props; // terminated by an entry with a NULL name
+    int n_props;
+    int n_alloc;
+    char *atoms[N_PROPERTY_ATOMS];
+    ArenaBlock *arena;
+} PropertySet;
+
+/* An entry of the udev index.  devname and devnum point into props. */
+typedef struct sUdevEntry
+{
+    PropertySet *props;
+    char *devname; // e.g. "/dev/sda1"
+    char *devnum; // e.g. "8:1"
+} UdevEntry;
+
+/* All block devices from the udev database, hashed by DEVNAME and by device
+number.  The property sets point into buf. */
+typedef struct sUdevIndex
+{
+    UdevEntry *entries;
+    int n_entries;
+    int *by_devname;
+    int *by_devnum;
+    int n_slots;
+    char *buf;
+} UdevIndex;
+
+/* Fills buf with up to size bytes.  Returns the number of bytes read, 0 at the
+end of the stream or -1 on an error, like read. */
+typedef int (*ReadFunc)(void *data, char *buf, int size);
+
+/* Splits a stream into lines without copying them.  Data is read into a fixed
+buffer supplied by the caller and newlines are found with memchr.  Only an
+incomplete line at the end of the buffer is moved to the front before reading
+more, so each byte is scanned and moved at most once.  Lines that don't fit in
+the buffer are skipped. */
+typedef struct sLineReader
+{
+    ReadFunc read;
+    void *data;
+    char *buf;
+    int size;
+    int start; // beginning of the next line
+    int scan; // where to continue looking for a newline
+    int end; // end of the data read so far
+    int eof;
+    int error;
+    int skipping; // discarding the rest of a line that didn't fit
+    int n_skipped; // lines that didn't fit
+} LineReader;
+
+/* Buffer size for reading udevadm output.  Longer lines are dropped. */
+#define PROPERTY_LINE_MAX 16384
+
+extern int verbosity;
+
+/* Prefix for /sys, /run/udev and /dev lookups.  Empty for the real system; set
+to a fixture directory for testing. */
+extern char sysroot[1024];
+
+/* Where sysfs is read from.  Empty for <sysroot>/sys; may be set separately
+to run against a synthetic sysfs tree. */
+extern char sysfs_root[1024];
+
+void get_sysfs_root(char *buf, int size);
+
+char *read_small_file(char *filename, int *size);
+void make_file_dir(char *filename);
+int property_atom(char *name);
+PropertySet *new_properties(void);
+char *properties_alloc(PropertySet *set, int size);
+void properties_adopt(PropertySet *set, char *buf);
+void add_property(PropertySet *set, char *name, char *value);
+void add_property_copy(PropertySet *set, char *name, int name_len, char *value, int value_len);
+int parse_property(char *str, int size, Property *prop);
+void init_line_reader(LineReader *reader, char *buf, int size, ReadFunc read, void *data);
+int next_line(LineReader *reader, char **line);
+int add_property_lines(PropertySet *set, LineReader *reader);
+PropertySet *get_device_properties(char *node);
+PropertySet *read_udev_properties(char *node);
+PropertySet *run_udevadm_properties(char *node);
+int get_node_devnum(char *node, char *buf, int size);
+UdevIndex *parse_udev_export_db(char *buf);
+UdevIndex *load_udev_index(char *filename);
+PropertySet *udev_index_lookup_node(UdevIndex *index, char *node);
+void free_udev_index(UdevIndex *index);
+char *get_property_value(PropertySet *set, char *name);
+int match_property_value(PropertySet *set, char *name, char *value);
+int match_atom_value(PropertySet *set, PropertyAtom atom, char *value);
+void free_properties(PropertySet *set);
+
+/* Value of an interned property, or NULL if the device doesn't have it. */
+#define get_atom_value(set, atom) ((set)->atoms[atom])
+
+#endif
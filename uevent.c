@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "uevent.h"
+
+/* The multicast group udevd sends processed events to.  Group 1 carries the
+raw kernel events, which arrive before udev has created the /dev/disk links. */
+#define UDEV_MONITOR_GROUP 2
+
+/**
+Opens a netlink socket listening to udev events.  Returns NULL if the socket
+could not be created, e.g. because udevd is not running in this namespace.
+*/
+UeventSource *uevent_open_netlink(void)
+{
+    UeventSource *src;
+    struct sockaddr_nl addr;
+    int fd;
+    int on = 1;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if(fd==-1)
+        return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UDEV_MONITOR_GROUP;
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr))==-1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /* Ask for sender credentials so that messages from unprivileged processes
+    can be ignored. */
+    setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+
+    src = (UeventSource *)calloc(1, sizeof(UeventSource));
+    src->fd = fd;
+    src->netlink = 1;
+
+    return src;
+}
+
+/**
+Wraps a file descriptor carrying a text stream of events, as printed by
+udevadm monitor --property.  The descriptor is made non-blocking and is closed
+by uevent_close.
+*/
+UeventSource *uevent_open_stream(int fd)
+{
+    UeventSource *src;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+
+    src = (UeventSource *)calloc(1, sizeof(UeventSource));
+    src->fd = fd;
+    src->bufsize = 4096;
+    src->buf = (char *)malloc(src->bufsize);
+
+    return src;
+}
+
+/**
+Adds a property given as a name=value string to an event, creating the event
+if needed.  Kernel events name devices relative to /dev, while udev uses
+absolute paths; DEVNAME is normalized to the latter.
+*/
+static PropertySet *add_uevent_property(PropertySet *set, char *str, int len)
+{
+    char *equals;
+
+    equals = memchr(str, '=', len);
+    if(!equals)
+        return set;
+
+    if(!set)
+        set = new_properties();
+
+    if(equals-str==7 && !memcmp(str, "DEVNAME", 7) && equals[1]!='/')
+    {
+        char devname[1024];
+        int devname_len = snprintf(devname, sizeof(devname), "/dev/%.*s", (int)(str+len-equals-1), equals+1);
+        add_property_copy(set, str, 7, devname, devname_len);
+    }
+    else
+        add_property_copy(set, str, equals-str, equals+1, str+len-equals-1);
+
+    return set;
+}
+
+/**
+Parses a netlink event datagram.  Both the kernel format (action@devpath
+followed by properties) and the libudev format (a binary header pointing at
+the properties) are understood.  Returns NULL if the datagram is malformed.
+*/
+PropertySet *parse_uevent_datagram(char *buf, int len)
+{
+    PropertySet *props = NULL;
+    int pos;
+    int end;
+
+    if(len>=24 && !memcmp(buf, "libudev", 8))
+    {
+        unsigned offset;
+        unsigned size;
+
+        memcpy(&offset, buf+16, sizeof(offset));
+        memcpy(&size, buf+20, sizeof(size));
+        if(offset>=(unsigned)len || size>(unsigned)len-offset)
+            return NULL;
+        pos = offset;
+        end = offset+size;
+    }
+    else
+    {
+        /* Skip the action@devpath summary; the same information is repeated
+        in the properties. */
+        pos = strnlen(buf, len)+1;
+        if(pos>=len || !strchr(buf, '@'))
+            return NULL;
+        end = len;
+    }
+
+    while(pos<end)
+    {
+        int field_len = strnlen(buf+pos, end-pos);
+        if(pos+field_len>=end)
+            break;
+        props = add_uevent_property(props, buf+pos, field_len);
+        pos += field_len+1;
+    }
+
+    return props;
+}
+
+/**
+Appends an event to a NULL-terminated array of events.
+*/
+static PropertySet **add_uevent(PropertySet **events, int *n_events, PropertySet *props)
+{
+    if(!props)
+        return events;
+    events = (PropertySet **)realloc(events, (*n_events+2)*sizeof(PropertySet *));
+    events[(*n_events)++] = props;
+    events[*n_events] = NULL;
+    return events;
+}
+
+/**
+Reads one netlink datagram.  Messages not sent by root are dropped.
+*/
+static PropertySet **read_netlink_event(UeventSource *src, int *eof)
+{
+    char buf[8192];
+    char control[CMSG_SPACE(sizeof(struct ucred))];
+    struct sockaddr_nl addr;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    PropertySet **events = NULL;
+    int n_events = 0;
+    int len;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf)-1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    len = recvmsg(src->fd, &msg, 0);
+    if(len<=0)
+        return NULL;
+    buf[len] = 0;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_type==SCM_CREDENTIALS)
+    {
+        struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
+        if(cred->uid!=0)
+        {
+            if(verbosity>=2)
+                printf("Ignoring event from uid %d\n", (int)cred->uid);
+            return NULL;
+        }
+    }
+
+    return add_uevent(events, &n_events, parse_uevent_datagram(buf, len));
+}
+
+/**
+Reads whatever is available from a text event stream.  Events end with an
+empty line; lines without an equals sign, such as the KERNEL[...] and UDEV
+[...] headers, are ignored.  A partial event stays in the buffer until the
+rest of it has arrived.
+*/
+static PropertySet **read_stream_events(UeventSource *src, int *eof)
+{
+    PropertySet **events = NULL;
+    int n_events = 0;
+    int len;
+
+    if(src->pos+2>=src->bufsize)
+    {
+        src->bufsize *= 2;
+        src->buf = (char *)realloc(src->buf, src->bufsize);
+    }
+
+    len = read(src->fd, src->buf+src->pos, src->bufsize-src->pos-2);
+    if(len==0)
+    {
+        /* Treat the end of the stream as the end of the last event. */
+        src->buf[src->pos++] = '\n';
+        src->buf[src->pos++] = '\n';
+        *eof = 1;
+    }
+    else if(len<0)
+        return NULL;
+    else
+        src->pos += len;
+
+    while(src->pos>0)
+    {
+        PropertySet *props = NULL;
+        char *end;
+        char *line;
+        char *next;
+
+        if(src->buf[0]=='\n')
+        {
+            memmove(src->buf, src->buf+1, --src->pos);
+            continue;
+        }
+
+        end = memmem(src->buf, src->pos, "\n\n", 2);
+        if(!end)
+            break;
+        *end = 0;
+
+        for(line=src->buf; line<end; line=next)
+        {
+            next = strchr(line, '\n');
+            if(next)
+                *next++ = 0;
+            else
+                next = end;
+            props = add_uevent_property(props, line, strlen(line));
+        }
+        events = add_uevent(events, &n_events, props);
+
+        len = end+2-src->buf;
+        memmove(src->buf, end+2, src->pos-len);
+        src->pos -= len;
+    }
+
+    return events;
+}
+
+/**
+Reads pending events from a source.  Returns a NULL-terminated array of
+property sets, or NULL if no complete event was available.  eof is set if a
+stream source has been exhausted.  Use free_uevents to free the result.
+*/
+PropertySet **uevent_read(UeventSource *src, int *eof)
+{
+    *eof = 0;
+    if(src->netlink)
+        return read_netlink_event(src, eof);
+    else
+        return read_stream_events(src, eof);
+}
+
+/**
+Frees an array of events returned by uevent_read.
+*/
+void free_uevents(PropertySet **events)
+{
+    int i;
+    if(!events)
+        return;
+    for(i=0; events[i]; ++i)
+        free_properties(events[i]);
+    free(events);
+}
+
+/**
+Closes an event source and frees it.
+*/
+void uevent_close(UeventSource *src)
+{
+    if(!src)
+        return;
+    close(src->fd);
+    free(src->buf);
+    free(src);
+}
@@ -0,0 +1,25 @@
+#ifndef UEVENT_H
+#define UEVENT_H
+
+#include "udev.h"
+
+/* A source of device events.  Events either come as datagrams from the udev
+netlink group, or as text in the format printed by udevadm monitor --property,
+which allows replaying recorded event streams. */
+typedef struct sUeventSource
+{
+    int fd;
+    int netlink;
+    char *buf;
+    int bufsize;
+    int pos;
+} UeventSource;
+
+UeventSource *uevent_open_netlink(void);
+UeventSource *uevent_open_stream(int fd);
+PropertySet *parse_uevent_datagram(char *buf, int len);
+PropertySet **uevent_read(UeventSource *src, int *eof);
+void free_uevents(PropertySet **events);
+void uevent_close(UeventSource *src);
+
+#endif
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "warmup.h"
+
+/* A freshly mounted FAT or exFAT stick on USB 2.0 takes a while to list: every
+directory is read block by block and every entry becomes an inode on first
+stat.  Reading the top levels with a few threads in parallel, while nobody is
+waiting for them yet, leaves the dentry and inode caches hot for the file
+manager.
+
+The walk is breadth first, so the directories the file manager shows first
+are done first.  The caller waits at most the time limit; workers still busy
+in a slow readdir then finish on their own and the shared state is freed by
+whoever is last. */
+
+int warmup_enabled = 0;
+WarmupLimits warmup_limits = { 2, 5000, 1500, 4 };
+
+typedef struct sWarmupDir
+{
+    char *path;
+    int depth; // 0 for the mountpoint
+} WarmupDir;
+
+typedef struct sWarmup
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // work was queued, or the warm-up is over
+    WarmupDir *queue;
+    int head; // next directory to read
+    int n_queued;
+    int n_alloc;
+    int busy; // workers reading a directory
+    int stop; // a limit was reached
+    int done; // no worker will take more work
+    int refs; // the caller and each worker
+    WarmupLimits limits;
+    WarmupStats stats; // counters are updated atomically
+} Warmup;
+
+/**
+Returns the time in milliseconds on the monotonic clock.
+*/
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+/**
+Sets the warm-up limits from a list like "depth=1,ms=500" and turns warm-up
+on.  "on" keeps the defaults.  Returns 0 on success or -1 if the list could
+not be parsed.
+*/
+int set_warmup_limits(char *spec)
+{
+    static char *names[] = { "depth", "entries", "ms", "threads" };
+    int *values[] = { &warmup_limits.depth, &warmup_limits.entries, &warmup_limits.ms, &warmup_limits.threads };
+    char *ptr = spec;
+
+    if(!strcmp(spec, "on"))
+    {
+        warmup_enabled = 1;
+        return 0;
+    }
+
+    while(*ptr)
+    {
+        char *end;
+        long value;
+        int len;
+        int i;
+
+        end = strchr(ptr, '=');
+        if(!end)
+            return -1;
+        len = end-ptr;
+        for(i=0; i<4; ++i)
+            if((int)strlen(names[i])==len && !strncmp(ptr, names[i], len))
+                break;
+        if(i==4)
+            return -1;
+
+        ptr = end+1;
+        value = strtol(ptr, &end, 10);
+        if(end==ptr || value<0 || value>1000000000 || (*end && *end!=','))
+            return -1;
+        if(values[i]==&warmup_limits.threads && value<1)
+            return -1;
+        *values[i] = value;
+
+        ptr = (*end ? end+1 : end);
+    }
+    warmup_enabled = 1;
+
+    return 0;
+}
+
+/**
+Writes a one-line account of a warm-up to buf.
+*/
+void describe_warmup(WarmupStats *stats, char *buf, int size)
+{
+    snprintf(buf, size, "warmed up %d entries in %d directories, %d files read ahead, in %.1f ms%s",
+        stats->entries, stats->dirs, stats->hinted, stats->ms, (stats->truncated ? " (stopped at the limit)" : ""));
+}
+
+/**
+Drops a reference to a warm-up and frees it with the last one.  Called with
+the lock held, which is released.
+*/
+static void unref_warmup(Warmup *w)
+{
+    int i;
+
+    if(--w->refs)
+    {
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for(i=w->head; i<w->n_queued; ++i)
+        free(w->queue[i].path);
+    free(w->queue);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
+
+/**
+Ends a warm-up early because a limit was reached.
+*/
+static void stop_warmup(Warmup *w)
+{
+    pthread_mutex_lock(&w->lock);
+    if(!w->done)
+    {
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELAXED);
+        w->stats.truncated = 1;
+    }
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void queue_directory(Warmup *w, char *path, int depth)
+{
+    pthread_mutex_lock(&w->lock);
+    if(w->n_queued==w->n_alloc)
+    {
+        w->n_alloc = (w->n_alloc ? w->n_alloc*2 : 64);
+        w->queue = (WarmupDir *)realloc(w->queue, w->n_alloc*sizeof(WarmupDir));
+    }
+    w->queue[w->n_queued].path = path;
+    w->queue[w->n_queued].depth = depth;
+    ++w->n_queued;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/**
+Asks the kernel to start reading the beginning of a file, without waiting for
+it.
+*/
+static void hint_file(Warmup *w, int dir_fd, char *name)
+{
+    int fd;
+
+    fd = openat(dir_fd, name, O_RDONLY|O_NOFOLLOW|O_NOCTTY|O_CLOEXEC);
+    if(fd==-1)
+        return;
+    if(posix_fadvise(fd, 0, WARMUP_HINT_BYTES, POSIX_FADV_WILLNEED)==0)
+        __atomic_add_fetch(&w->stats.hinted, 1, __ATOMIC_RELAXED);
+    close(fd);
+}
+
+/**
+Reads a directory and stats its entries, queueing the subdirectories that are
+within the depth limit.
+*/
+static void read_directory(Warmup *w, WarmupDir *dir)
+{
+    struct dirent *ent;
+    DIR *d;
+    int fd;
+
+    fd = open(dir->path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if(fd==-1 || !(d = fdopendir(fd)))
+    {
+        if(fd!=-1)
+            close(fd);
+        __atomic_add_fetch(&w->stats.errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&w->stats.dirs, 1, __ATOMIC_RELAXED);
+
+    while(!__atomic_load_n(&w->stop, __ATOMIC_RELAXED) && (ent = readdir(d)))
+    {
+        struct stat st;
+        int n;
+
+        if(ent->d_name[0]=='.' && (!ent->d_name[1] || (ent->d_name[1]=='.' && !ent->d_name[2])))
+            continue;
+
+        n = __atomic_add_fetch(&w->stats.entries, 1, __ATOMIC_RELAXED);
+        if(w->limits.entries && n>w->limits.entries)
+        {
+            __atomic_sub_fetch(&w->stats.entries, 1, __ATOMIC_RELAXED);
+            stop_warmup(w);
+            break;
+        }
+
+        if(fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW)<0)
+        {
+            __atomic_add_fetch(&w->stats.errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if(S_ISDIR(st.st_mode) && (!w->limits.depth || dir->depth<w->limits.depth))
+        {
+            char *path = (char *)malloc(strlen(dir->path)+strlen(ent->d_name)+2);
+            sprintf(path, "%s/%s", dir->path, ent->d_name);
+            queue_directory(w, path, dir->depth+1);
+        }
+        /* Only the files the file manager shows straight away. */
+        else if(S_ISREG(st.st_mode) && dir->depth==0 && st.st_size>0)
+            hint_file(w, fd, ent->d_name);
+    }
+
+    closedir(d);
+}
+
+static void *warmup_thread(void *data)
+{
+    Warmup *w = (Warmup *)data;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;)
+    {
+        WarmupDir dir;
+
+        /* An empty queue is only the end once nobody can add to it. */
+        while(!w->stop && w->head==w->n_queued && w->busy)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(w->stop || w->head==w->n_queued)
+            break;
+
+        dir = w->queue[w->head++];
+        ++w->busy;
+        pthread_mutex_unlock(&w->lock);
+
+        read_directory(w, &dir);
+        free(dir.path);
+
+        pthread_mutex_lock(&w->lock);
+        --w->busy;
+    }
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    unref_warmup(w);
+
+    return NULL;
+}
+
+/**
+Reads the directories of a new mount into the kernel's caches, within the
+given limits, and fills in stats with what was done.  Returns after the tree
+has been read or a limit was reached.
+*/
+void warm_up_mountpoint(char *mountpoint, WarmupLimits *limits, WarmupStats *stats)
+{
+    double start = get_time_ms();
+    pthread_condattr_t attr;
+    pthread_attr_t thread_attr;
+    struct timespec deadline;
+    Warmup *w;
+    int i;
+
+    w = (Warmup *)calloc(1, sizeof(Warmup));
+    w->limits = *limits;
+    w->refs = 1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    queue_directory(w, strdup(mountpoint), 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += limits->ms/1000;
+    deadline.tv_nsec += (limits->ms%1000)*1000000L;
+    if(deadline.tv_nsec>=1000000000L)
+    {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    for(i=0; i<limits->threads; ++i)
+    {
+        pthread_t thread;
+
+        pthread_mutex_lock(&w->lock);
+        ++w->refs;
+        pthread_mutex_unlock(&w->lock);
+        if(pthread_create(&thread, &thread_attr, &warmup_thread, w))
+        {
+            pthread_mutex_lock(&w->lock);
+            --w->refs;
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+    }
+    pthread_attr_destroy(&thread_attr);
+
+    /* Do the work here if no thread could be started. */
+    if(i==0)
+    {
+        pthread_mutex_lock(&w->lock);
+        ++w->refs;
+        pthread_mutex_unlock(&w->lock);
+        warmup_thread(w);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while(!w->done)
+    {
+        if(!limits->ms)
+            pthread_cond_wait(&w->cond, &w->lock);
+        else if(pthread_cond_timedwait(&w->cond, &w->lock, &deadline)==ETIMEDOUT && !w->done)
+        {
+            __atomic_store_n(&w->stop, 1, __ATOMIC_RELAXED);
+            w->stats.truncated = 1;
+            pthread_cond_broadcast(&w->cond);
+            break;
+        }
+    }
+    stats->dirs = __atomic_load_n(&w->stats.dirs, __ATOMIC_RELAXED);
+    stats->entries = __atomic_load_n(&w->stats.entries, __ATOMIC_RELAXED);
+    stats->hinted = __atomic_load_n(&w->stats.hinted, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&w->stats.errors, __ATOMIC_RELAXED);
+    stats->truncated = w->stats.truncated;
+    stats->ms = get_time_ms()-start;
+    unref_warmup(w);
+}
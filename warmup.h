@@ -0,0 +1,37 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+/* How much of a new mount is read before the file manager is started.  Each
+limit of 0 means none, except threads. */
+typedef struct sWarmupLimits
+{
+    int depth; // levels of directories below the mountpoint
+    int entries; // directory entries looked at
+    int ms; // time the caller waits
+    int threads;
+} WarmupLimits;
+
+/* Set by -W; warm-up is off while enabled is 0. */
+extern int warmup_enabled;
+extern WarmupLimits warmup_limits;
+
+/* Bytes at the start of each file in the mountpoint that are read ahead, for
+file managers that sniff contents to pick an icon. */
+#define WARMUP_HINT_BYTES 16384
+
+/* What a warm-up did. */
+typedef struct sWarmupStats
+{
+    int dirs; // directories read
+    int entries; // entries stat'ed
+    int hinted; // files read ahead
+    int errors; // entries or directories that could not be read
+    int truncated; // stopped by a limit before the tree was done
+    double ms;
+} WarmupStats;
+
+int set_warmup_limits(char *spec);
+void warm_up_mountpoint(char *mountpoint, WarmupLimits *limits, WarmupStats *stats);
+void describe_warmup(WarmupStats *stats, char *buf, int size);
+
+#endif
@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "udev.h"
+#include "writeback.h"
+
+/**
+Writes back all dirty data of the filesystem mounted on a directory, and waits
+for it to reach the device.  This can take a long time after a large copy to a
+slow stick.  Returns 0 on success or -1 on failure.
+*/
+int sync_mountpoint(char *mountpoint)
+{
+    int fd;
+    int result;
+
+    fd = open(mountpoint, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(fd==-1)
+        return -1;
+
+    result = syncfs(fd);
+    close(fd);
+
+    return result;
+}
+
+/**
+Reads the value of a line from /proc/meminfo, in kilobytes.
+*/
+static long long get_meminfo_value(char *buf, char *name)
+{
+    int len = strlen(name);
+    char *ptr;
+
+    for(ptr=buf; ptr; ptr=strchr(ptr, '\n'))
+    {
+        if(*ptr=='\n')
+            ++ptr;
+        if(!strncmp(ptr, name, len) && ptr[len]==':')
+            return atoll(ptr+len+1);
+    }
+
+    return -1;
+}
+
+/**
+Reads how much data is still waiting to be written, both in total and for the
+block device with a given short name, e.g. sdb1.
+*/
+void read_writeback_stats(char *shortdev, WritebackStats *stats)
+{
+    char fnbuf[1100];
+    char *buf;
+
+    stats->dirty_kb = -1;
+    stats->writeback_kb = -1;
+    stats->sectors_written = -1;
+    stats->in_flight = -1;
+
+    snprintf(fnbuf, sizeof(fnbuf), "%s/proc/meminfo", sysroot);
+    buf = read_small_file(fnbuf, NULL);
+    if(buf)
+    {
+        stats->dirty_kb = get_meminfo_value(buf, "Dirty");
+        stats->writeback_kb = get_meminfo_value(buf, "Writeback");
+        free(buf);
+    }
+
+    /* Fields 7 and 9 are sectors written and requests in flight. */
+    get_sysfs_root(fnbuf, sizeof(fnbuf));
+    snprintf(fnbuf+strlen(fnbuf), sizeof(fnbuf)-strlen(fnbuf), "/class/block/%s/stat", shortdev);
+    buf = read_small_file(fnbuf, NULL);
+    if(buf)
+    {
+        long long fields[9];
+        if(sscanf(buf, "%lld %lld %lld %lld %lld %lld %lld %lld %lld", &fields[0], &fields[1], &fields[2],
+            &fields[3], &fields[4], &fields[5], &fields[6], &fields[7], &fields[8])==9)
+        {
+            stats->sectors_written = fields[6];
+            stats->in_flight = fields[8];
+        }
+        free(buf);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+/* How much data is waiting to be written.  The dirty and writeback counters
+are system wide, from /proc/meminfo; the others are for one block device, from
+its stat file in sysfs.  Counters that could not be read are -1. */
+typedef struct sWritebackStats
+{
+    long long dirty_kb;
+    long long writeback_kb;
+    long long sectors_written;
+    long long in_flight;
+} WritebackStats;
+
+int sync_mountpoint(char *mountpoint);
+void read_writeback_stats(char *shortdev, WritebackStats *stats);
+
+#endif